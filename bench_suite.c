@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "mem_pool.h"
+
+
+/*******************************************/
+/*****            constants            *****/
+/*******************************************/
+static const size_t   BENCH_POOL_SIZE = 1000000;
+static const size_t   BENCH_ALLOC_SIZE = 64;
+static const unsigned BENCH_OPS_PER_PAIR = 1000000;
+static const unsigned BENCH_MAX_PAIRS = 8;
+static const unsigned BENCH_OPS_PER_THREAD = 1000000;
+static const unsigned BENCH_LIVE_ALLOCS = 64;
+#define               BENCH_FRAG_LIVE 2000
+static const size_t   BENCH_FRAG_MAX_SIZE = 300;
+#define               BENCH_RING_SIZE 1024
+
+
+
+/*******************************************/
+/*****         helper routines         *****/
+/*******************************************/
+
+// single-producer single-consumer ring of allocations
+typedef struct _ring {
+    alloc_pt slots[BENCH_RING_SIZE];
+    _Atomic unsigned head;  // next slot to read
+    _Atomic unsigned tail;  // next slot to write
+} ring_t, *ring_pt;
+
+typedef struct _pair {
+    pool_pt pool;
+    unsigned flags;
+    pthread_mutex_t *lock;  // shared with the consumer when frees aren't remote
+    ring_t ring;
+} pair_t, *pair_pt;
+
+static void ring_push(ring_pt ring, alloc_pt alloc) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == BENCH_RING_SIZE) {
+        sched_yield();
+    }
+    ring->slots[tail % BENCH_RING_SIZE] = alloc;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static alloc_pt ring_pop(ring_pt ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+        sched_yield();
+    }
+    alloc_pt alloc = ring->slots[head % BENCH_RING_SIZE];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return alloc;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the producer opens the pool, so it is the owner
+static void *producer(void *arg) {
+    pair_pt pair = (pair_pt) arg;
+    pool_opts_t opts = { pair->flags };
+
+    pair->pool = mem_pool_open_opts(BENCH_POOL_SIZE, FIRST_FIT, &opts);
+    for (unsigned i = 0; i < BENCH_OPS_PER_PAIR; ++i) {
+        alloc_pt alloc = NULL;
+        while (alloc == NULL) {
+            if (pair->lock) pthread_mutex_lock(pair->lock);
+            alloc = mem_new_alloc(pair->pool, BENCH_ALLOC_SIZE);
+            if (pair->lock) pthread_mutex_unlock(pair->lock);
+            if (alloc == NULL) sched_yield();
+        }
+        ring_push(&pair->ring, alloc);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    pair_pt pair = (pair_pt) arg;
+
+    for (unsigned i = 0; i < BENCH_OPS_PER_PAIR; ++i) {
+        alloc_pt alloc = ring_pop(&pair->ring);
+        if (pair->lock) pthread_mutex_lock(pair->lock);
+        mem_del_alloc(pair->pool, alloc);
+        if (pair->lock) pthread_mutex_unlock(pair->lock);
+    }
+    return NULL;
+}
+
+// run num_pairs producer/consumer pairs, one pool per pair, and
+// return the throughput in million alloc/free pairs per second
+static double bench_pairs(unsigned num_pairs, int remote) {
+    pair_pt pairs = calloc(num_pairs, sizeof(pair_t));
+    pthread_mutex_t *locks = calloc(num_pairs, sizeof(pthread_mutex_t));
+    pthread_t *threads = calloc(2 * num_pairs, sizeof(pthread_t));
+
+    for (unsigned p = 0; p < num_pairs; ++p) {
+        pairs[p].flags = remote ? POOL_OWNER_THREAD : POOL_DEFAULT;
+        if (!remote) {
+            pthread_mutex_init(&locks[p], NULL);
+            pairs[p].lock = &locks[p];
+        }
+    }
+
+    double start = now();
+    for (unsigned p = 0; p < num_pairs; ++p) {
+        pthread_create(&threads[2 * p], NULL, producer, &pairs[p]);
+        // the pool store isn't thread-safe, so the producers open their
+        // pools one at a time; the consumer starts once the pool is open
+        while (atomic_load_explicit(&pairs[p].ring.tail, memory_order_acquire) == 0) {
+            sched_yield();
+        }
+        pthread_create(&threads[2 * p + 1], NULL, consumer, &pairs[p]);
+    }
+    for (unsigned t = 0; t < 2 * num_pairs; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    double elapsed = now() - start;
+
+    for (unsigned p = 0; p < num_pairs; ++p) {
+        // close drains the last remote frees
+        mem_pool_close(pairs[p].pool);
+        if (!remote) {
+            pthread_mutex_destroy(&locks[p]);
+        }
+    }
+    free(threads);
+    free(locks);
+    free(pairs);
+
+    return num_pairs * (double) BENCH_OPS_PER_PAIR / elapsed / 1e6;
+}
+
+
+typedef struct _worker {
+    pool_pt pool;
+    pthread_mutex_t *lock;  // around every call, unless the pool is sharded
+} worker_t, *worker_pt;
+
+// allocate and free with a few allocations live at any time
+static void *worker(void *arg) {
+    worker_pt w = (worker_pt) arg;
+    alloc_pt live[BENCH_LIVE_ALLOCS];
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < BENCH_OPS_PER_THREAD; ++i) {
+        if (w->lock) pthread_mutex_lock(w->lock);
+        if (n == BENCH_LIVE_ALLOCS) {
+            mem_del_alloc(w->pool, live[--n]);
+        }
+        alloc_pt alloc = mem_new_alloc(w->pool, BENCH_ALLOC_SIZE + (i % 4) * 16);
+        if (w->lock) pthread_mutex_unlock(w->lock);
+        if (alloc != NULL) {
+            live[n++] = alloc;
+        }
+    }
+    if (w->lock) pthread_mutex_lock(w->lock);
+    while (n > 0) {
+        mem_del_alloc(w->pool, live[--n]);
+    }
+    if (w->lock) pthread_mutex_unlock(w->lock);
+    return NULL;
+}
+
+// run num_threads workers on one pool, either a single pool behind a
+// mutex or a pool with a shard per thread, and return the throughput in
+// million operations per second
+static double bench_shared(unsigned num_threads, int sharded) {
+    pthread_mutex_t lock;
+    worker_t w = { NULL, NULL };
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+
+    if (sharded) {
+        w.pool = mem_pool_open_sharded(BENCH_POOL_SIZE * num_threads, FIRST_FIT, num_threads);
+    } else {
+        pthread_mutex_init(&lock, NULL);
+        w.lock = &lock;
+        w.pool = mem_pool_open(BENCH_POOL_SIZE * num_threads, FIRST_FIT);
+    }
+
+    double start = now();
+    for (unsigned t = 0; t < num_threads; ++t) {
+        pthread_create(&threads[t], NULL, worker, &w);
+    }
+    for (unsigned t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    double elapsed = now() - start;
+
+    mem_pool_close(w.pool);
+    if (!sharded) {
+        pthread_mutex_destroy(&lock);
+    }
+    free(threads);
+
+    return num_threads * (double) BENCH_OPS_PER_THREAD / elapsed / 1e6;
+}
+
+
+// one thread churning through a few sizes, and return the throughput
+// in million operations per second
+static double bench_churn(alloc_policy policy, unsigned flags) {
+    pool_opts_t opts = { flags };
+    worker_t w = { mem_pool_open_opts(BENCH_POOL_SIZE, policy, &opts), NULL };
+
+    double start = now();
+    worker(&w);
+    double elapsed = now() - start;
+
+    mem_pool_close(w.pool);
+
+    return (double) BENCH_OPS_PER_THREAD / elapsed / 1e6;
+}
+
+
+// blocks of random sizes freed in random order, many live at any time,
+// and return the throughput in million operations per second with the
+// fragmentation at the end
+static double bench_frag(const pool_opts_t *opts, pool_frag_t *frag) {
+    pool_pt pool = mem_pool_open_opts(BENCH_POOL_SIZE, BEST_FIT, opts);
+    alloc_pt live[BENCH_FRAG_LIVE] = { NULL };
+    unsigned seed = 1;
+
+    double start = now();
+    for (unsigned i = 0; i < BENCH_OPS_PER_THREAD; ++i) {
+        unsigned k = (unsigned) rand_r(&seed) % BENCH_FRAG_LIVE;
+        if (live[k] != NULL) {
+            mem_del_alloc(pool, live[k]);
+        }
+        live[k] = mem_new_alloc(pool, 1 + (size_t) rand_r(&seed) % BENCH_FRAG_MAX_SIZE);
+    }
+    double elapsed = now() - start;
+
+    mem_pool_frag(pool, frag);
+    for (unsigned k = 0; k < BENCH_FRAG_LIVE; ++k) {
+        if (live[k] != NULL) {
+            mem_del_alloc(pool, live[k]);
+        }
+    }
+    mem_pool_close(pool);
+
+    return (double) BENCH_OPS_PER_THREAD / elapsed / 1e6;
+}
+
+
+
+/*******************************************/
+/*****         benchmark driver        *****/
+/*******************************************/
+
+int main(int argc, char *argv[]) {
+    unsigned max_pairs = BENCH_MAX_PAIRS;
+    // the number of threads (pairs) to scale up to
+    if (argc > 1) {
+        max_pairs = (unsigned) atoi(argv[1]);
+    }
+
+    if (mem_init() != ALLOC_OK) {
+        return 1;
+    }
+
+    printf("producer/consumer: %u allocs of %zu bytes per pair\n",
+           BENCH_OPS_PER_PAIR, BENCH_ALLOC_SIZE);
+    printf("%7s %16s %16s\n", "pairs", "locked (M/s)", "remote (M/s)");
+    for (unsigned pairs = 1; pairs <= max_pairs; pairs *= 2) {
+        double locked = bench_pairs(pairs, 0);
+        double remote = bench_pairs(pairs, 1);
+        printf("%7u %16.2f %16.2f\n", pairs, locked, remote);
+    }
+
+    printf("\nshared pool: %u alloc/free per thread, %u live\n",
+           BENCH_OPS_PER_THREAD, BENCH_LIVE_ALLOCS);
+    printf("%7s %16s %16s\n", "threads", "locked (M/s)", "sharded (M/s)");
+    for (unsigned threads = 1; threads <= max_pairs; threads *= 2) {
+        double locked = bench_shared(threads, 0);
+        double sharded = bench_shared(threads, 1);
+        printf("%7u %16.2f %16.2f\n", threads, locked, sharded);
+    }
+
+    printf("\nchurn: %u alloc/free, %u live\n", BENCH_OPS_PER_THREAD, BENCH_LIVE_ALLOCS);
+    printf("%7s %16s %16s\n", "policy", "merged (M/s)", "deferred (M/s)");
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        double merged = bench_churn(policy, POOL_DEFAULT);
+        double deferred = bench_churn(policy, POOL_DEFERRED_COALESCING);
+        printf("%7s %16.2f %16.2f\n", policy == FIRST_FIT ? "first" : "best", merged, deferred);
+    }
+
+    struct {
+        const char *name;
+        pool_opts_t opts;
+    } layouts[] = {
+        { "exact", { POOL_DEFAULT, 0, 0, 0 } },
+        { "16", { POOL_DEFAULT, 0, 16, 0 } },
+        { "16 split 64", { POOL_DEFAULT, 0, 16, 64 } },
+        { "classes", { POOL_SIZE_CLASSES, 0, 16, 64 } },
+    };
+    printf("\nfragmentation: %u alloc/free of 1-%zu bytes, %u live, best fit\n",
+           BENCH_OPS_PER_THREAD, BENCH_FRAG_MAX_SIZE, BENCH_FRAG_LIVE);
+    printf("%12s %10s %8s %8s %10s %10s\n", "granularity", "M/s", "gaps", "small", "internal", "external");
+    for (unsigned i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+        pool_frag_t frag;
+        double rate = bench_frag(&layouts[i].opts, &frag);
+        printf("%12s %10.2f %8u %8u %9.1f%% %9.1f%%\n", layouts[i].name, rate, frag.num_gaps,
+               frag.num_small_gaps, 100 * frag.internal, 100 * frag.external);
+    }
+
+    return mem_free() == ALLOC_OK ? 0 : 1;
+}
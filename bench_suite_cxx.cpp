@@ -0,0 +1,230 @@
+#include <chrono>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mem_pool.hpp"
+
+
+/*******************************************/
+/*****            constants            *****/
+/*******************************************/
+static const size_t   BENCH_POOL_SIZE = 64 << 20;
+static const unsigned BENCH_ELEMENTS = 100000;
+static const unsigned BENCH_ROUNDS = 20;
+static const size_t   BENCH_STRING_SIZE = 40;    // past the small string buffer
+static const unsigned BENCH_OBJECT_OPS = 10000000;
+#define               BENCH_LIVE_OBJECTS 64
+
+
+
+/*******************************************/
+/*****         helper routines         *****/
+/*******************************************/
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// fill and empty a hash map
+static void map_round(std::pmr::memory_resource *resource) {
+    std::pmr::unordered_map<unsigned, unsigned> map(resource);
+    for (unsigned i = 0; i < BENCH_ELEMENTS; ++i) {
+        map.emplace(i, i);
+    }
+    for (unsigned i = 0; i < BENCH_ELEMENTS; ++i) {
+        map.erase(i);
+    }
+}
+
+// fill and empty a vector of strings
+static void strings_round(std::pmr::memory_resource *resource) {
+    std::pmr::vector<std::pmr::string> strings(resource);
+    strings.reserve(BENCH_ELEMENTS);
+    for (unsigned i = 0; i < BENCH_ELEMENTS; ++i) {
+        strings.emplace_back(BENCH_STRING_SIZE, (char) ('a' + i % 26));
+    }
+}
+
+// grow a vector one element at a time
+static void vector_round(std::pmr::memory_resource *resource) {
+    std::pmr::vector<unsigned> ints(resource);
+    for (unsigned i = 0; i < BENCH_ELEMENTS * 10; ++i) {
+        ints.push_back(i);
+    }
+}
+
+typedef void (*round_fn)(std::pmr::memory_resource *);
+
+// run the rounds on a resource, a fresh monotonic buffer per round with
+// monotonic, and return the throughput in million elements per second
+static double bench_rounds(round_fn round, unsigned elements, std::pmr::memory_resource *resource,
+                           bool monotonic) {
+    double start = now();
+    for (unsigned r = 0; r < BENCH_ROUNDS; ++r) {
+        if (monotonic) {
+            std::pmr::monotonic_buffer_resource buffer(resource);
+            round(&buffer);
+        } else {
+            round(resource);
+        }
+    }
+    double elapsed = now() - start;
+
+    return BENCH_ROUNDS * (double) elements / elapsed / 1e6;
+}
+
+
+// message types of a few sizes
+struct heartbeat {
+    unsigned long sequence;
+    unsigned long timestamp;
+};
+
+struct order_update {
+    unsigned long order_id;
+    unsigned long timestamp;
+    double price;
+    double quantity;
+    char symbol[16];
+    unsigned flags;
+};
+
+struct market_data {
+    unsigned long timestamp;
+    double bids[10];
+    double asks[10];
+    unsigned depth;
+};
+
+// create and destroy objects, a few live at any time, with new and
+// delete, and return the throughput in million operations per second
+template <typename T>
+static double bench_new_delete() {
+    T *live[BENCH_LIVE_OBJECTS];
+    unsigned n = 0;
+
+    double start = now();
+    for (unsigned i = 0; i < BENCH_OBJECT_OPS; ++i) {
+        if (n == BENCH_LIVE_OBJECTS) {
+            delete live[--n];
+        }
+        live[n++] = new T();
+    }
+    while (n > 0) {
+        delete live[--n];
+    }
+    double elapsed = now() - start;
+
+    return BENCH_OBJECT_OPS / elapsed / 1e6;
+}
+
+// the same in a pool, block by block
+template <typename T>
+static double bench_pool_blocks(pool_pt pool) {
+    T *live[BENCH_LIVE_OBJECTS];
+    unsigned n = 0;
+
+    double start = now();
+    for (unsigned i = 0; i < BENCH_OBJECT_OPS; ++i) {
+        if (n == BENCH_LIVE_OBJECTS) {
+            T *object = live[--n];
+            object->~T();
+            mem_release(pool, object);
+        }
+        live[n++] = ::new (mem_alloc(pool, sizeof(T))) T();
+    }
+    while (n > 0) {
+        T *object = live[--n];
+        object->~T();
+        mem_release(pool, object);
+    }
+    double elapsed = now() - start;
+
+    return BENCH_OBJECT_OPS / elapsed / 1e6;
+}
+
+// the same in an object pool
+template <typename T>
+static double bench_object_pool(pool_pt pool) {
+    ObjectPool<T> objects(pool);
+    T *live[BENCH_LIVE_OBJECTS];
+    unsigned n = 0;
+
+    double start = now();
+    for (unsigned i = 0; i < BENCH_OBJECT_OPS; ++i) {
+        if (n == BENCH_LIVE_OBJECTS) {
+            objects.destroy(live[--n]);
+        }
+        live[n++] = objects.create();
+    }
+    while (n > 0) {
+        objects.destroy(live[--n]);
+    }
+    double elapsed = now() - start;
+
+    return BENCH_OBJECT_OPS / elapsed / 1e6;
+}
+
+template <typename T>
+static void bench_objects(const char *name, pool_pt pool) {
+    double newDelete = bench_new_delete<T>();
+    double blocks = bench_pool_blocks<T>(pool);
+    double objects = bench_object_pool<T>(pool);
+    printf("%14s %6zu %12.2f %12.2f %12.2f\n", name, sizeof(T), newDelete, blocks, objects);
+}
+
+
+
+/*******************************************/
+/*****         benchmark driver        *****/
+/*******************************************/
+
+int main() {
+    if (mem_init() != ALLOC_OK) {
+        return 1;
+    }
+
+    pool_opts_t deferred = { POOL_DEFERRED_COALESCING, 0 };
+    pool_pt bestPool = mem_pool_open(BENCH_POOL_SIZE, BEST_FIT);
+    pool_pt deferredPool = mem_pool_open_opts(BENCH_POOL_SIZE, BEST_FIT, &deferred);
+    if (bestPool == nullptr || deferredPool == nullptr) {
+        return 1;
+    }
+    mem_pool_resource best(bestPool);
+    mem_pool_resource quick(deferredPool);
+
+    struct {
+        const char *name;
+        round_fn round;
+        unsigned elements;
+    } workloads[] = {
+        { "map", map_round, 2 * BENCH_ELEMENTS },
+        { "strings", strings_round, BENCH_ELEMENTS },
+        { "vector", vector_round, 10 * BENCH_ELEMENTS },
+    };
+
+    printf("pmr containers: %u rounds, million elements per second\n", BENCH_ROUNDS);
+    printf("%8s %12s %12s %12s %12s\n", "workload", "new/delete", "monotonic", "best fit", "deferred");
+    for (const auto &w : workloads) {
+        double newDelete = bench_rounds(w.round, w.elements, std::pmr::new_delete_resource(), false);
+        double monotonic = bench_rounds(w.round, w.elements, std::pmr::new_delete_resource(), true);
+        double pool = bench_rounds(w.round, w.elements, &best, false);
+        double poolDeferred = bench_rounds(w.round, w.elements, &quick, false);
+        printf("%8s %12.2f %12.2f %12.2f %12.2f\n", w.name, newDelete, monotonic, pool, poolDeferred);
+    }
+
+    printf("\nobjects: %u create/destroy, %u live, million operations per second\n",
+           BENCH_OBJECT_OPS, BENCH_LIVE_OBJECTS);
+    printf("%14s %6s %12s %12s %12s\n", "type", "size", "new/delete", "pool blocks", "object pool");
+    bench_objects<heartbeat>("heartbeat", bestPool);
+    bench_objects<order_update>("order_update", bestPool);
+    bench_objects<market_data>("market_data", bestPool);
+
+    mem_pool_close(bestPool);
+    mem_pool_close(deferredPool);
+
+    return mem_free() == ALLOC_OK ? 0 : 1;
+}
@@ -2,31 +2,171 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#define _GNU_SOURCE // for sched_getcpu()
+
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h> // for memmove(), memcpy()
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h> // for mmap(), madvise()
+#include <sys/syscall.h> // for mbind(), set_mempolicy() without libnuma
+#include <linux/mempolicy.h>
+#include <unistd.h> // for sysconf(), syscall(), ftruncate()
+#include <fcntl.h> // for open()
+#include <sys/stat.h> // for fstat()
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <errno.h> // for EOWNERDEAD
 
 #include "mem_pool.h"
 
+// built into the preload library (see mem_preload.c), malloc and friends
+// are the pools: the metadata of the pools comes from the libc allocator
+// underneath them
+#ifdef MEM_POOL_PRELOAD
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+#define malloc(size)                    __libc_malloc(size)
+#define calloc(num, size)               __libc_calloc(num, size)
+#define realloc(ptr, size)              __libc_realloc(ptr, size)
+#define aligned_alloc(alignment, size)  __libc_memalign(alignment, size)
+#define free(ptr)                       __libc_free(ptr)
+#endif
+
 /*************/
 /*           */
 /* Constants */
 /*           */
 /*************/
-static const float      MEM_FILL_FACTOR                 = 0.75;
-static const unsigned   MEM_EXPAND_FACTOR               = 2;
+// the tuning below is set at compile time: define any of these to
+// override it, e.g. -DMEM_NODE_HEAP_INIT_CAPACITY=1024
+#ifndef MEM_FILL_FACTOR
+#define MEM_FILL_FACTOR                 0.75
+#endif
+#ifndef MEM_EXPAND_FACTOR
+#define MEM_EXPAND_FACTOR               2
+#endif
+
+#ifndef MEM_POOL_STORE_INIT_CAPACITY
+#define MEM_POOL_STORE_INIT_CAPACITY    20
+#endif
+#ifndef MEM_POOL_STORE_FILL_FACTOR
+#define MEM_POOL_STORE_FILL_FACTOR      0.75
+#endif
+#ifndef MEM_POOL_STORE_EXPAND_FACTOR
+#define MEM_POOL_STORE_EXPAND_FACTOR    2
+#endif
+
+#ifndef MEM_NODE_HEAP_INIT_CAPACITY
+#define MEM_NODE_HEAP_INIT_CAPACITY     40
+#endif
+#ifndef MEM_NODE_HEAP_FILL_FACTOR
+#define MEM_NODE_HEAP_FILL_FACTOR       0.75
+#endif
+#ifndef MEM_NODE_HEAP_EXPAND_FACTOR
+#define MEM_NODE_HEAP_EXPAND_FACTOR     2
+#endif
+
+#ifndef MEM_GAP_IX_INIT_CAPACITY
+#define MEM_GAP_IX_INIT_CAPACITY        40
+#endif
+#ifndef MEM_GAP_IX_FILL_FACTOR
+#define MEM_GAP_IX_FILL_FACTOR          0.75
+#endif
+#ifndef MEM_GAP_IX_EXPAND_FACTOR
+#define MEM_GAP_IX_EXPAND_FACTOR        2
+#endif
+
+// POOL_DEFERRED_COALESCING: the number of sizes with a quick list (power
+// of 2), and the number of quick blocks at which they are merged
+#ifndef MEM_QUICK_BINS
+#define MEM_QUICK_BINS                  64
+#endif
+#ifndef MEM_QUICK_MERGE_THRESHOLD
+#define MEM_QUICK_MERGE_THRESHOLD       256
+#endif
+//   POOL_BACKGROUND pools leave the merge to the maintenance thread, up
+//   to this many times the threshold
+#ifndef MEM_QUICK_BACKGROUND_FACTOR
+#define MEM_QUICK_BACKGROUND_FACTOR     4
+#endif
+
+// the maintenance thread: default time between passes and work per pass
+#ifndef MEM_MAINT_INTERVAL_MS
+#define MEM_MAINT_INTERVAL_MS           100
+#endif
+#ifndef MEM_MAINT_BUDGET
+#define MEM_MAINT_BUDGET                (1 << 16)
+#endif
+//   and how long a gap is left free before its pages are purged
+#ifndef MEM_MAINT_DECAY_MS
+#define MEM_MAINT_DECAY_MS              1000
+#endif
+
+// mem_inspect_pool: a walk torn by a writer this many times is done under
+// the pool's lock, in the pools that have one
+#ifndef MEM_INSPECT_RETRIES
+#define MEM_INSPECT_RETRIES             8
+#endif
 
-static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
-static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
-static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
+// POOL_RESERVE: memory is committed in steps of this size (a multiple
+// of the page size)
+#ifndef MEM_RESERVE_COMMIT_SIZE
+#define MEM_RESERVE_COMMIT_SIZE         ((size_t) 1 << 20)
+#endif
 
-static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
-static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
-static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+// free by address: the offset index of a pool (a power of 2), and the
+// address ranges of the open pools
+#ifndef MEM_OFFSET_IX_INIT_CAPACITY
+#define MEM_OFFSET_IX_INIT_CAPACITY     64
+#endif
+#ifndef MEM_OFFSET_IX_FILL_FACTOR
+#define MEM_OFFSET_IX_FILL_FACTOR       0.75
+#endif
+#ifndef MEM_POOL_RANGES_INIT_CAPACITY
+#define MEM_POOL_RANGES_INIT_CAPACITY   20
+#endif
 
-static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
-static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
-static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+// MEM_POOL_SHARED: the buckets of a process's records (a power of 2)
+#ifndef MEM_SHARED_RECORDS_INIT_CAPACITY
+#define MEM_SHARED_RECORDS_INIT_CAPACITY    64
+#endif
+
+// POOL_SIZE_CLASSES: sizes up to this many granules are rounded to the
+// granularity, larger ones to this many classes per power of 2
+#ifndef MEM_SIZE_CLASS_LINEAR
+#define MEM_SIZE_CLASS_LINEAR           8
+#endif
+#ifndef MEM_SIZE_CLASSES_PER_DOUBLING
+#define MEM_SIZE_CLASSES_PER_DOUBLING   4
+#endif
+
+// allocation records live in aligned chunks of this size (power of 2)
+#define MEM_ALLOC_CHUNK_SIZE    4096
+
+// internal pool flags, above the user-facing pool_flags
+#define MEM_POOL_SHARED         (1u << 28)  // a file-backed pool open in several processes
+#define MEM_POOL_FILE           (1u << 29)  // a file-backed boundary-tag pool
+#define MEM_POOL_SHARDED        (1u << 30)  // a set of shards, no segments of its own
+#define MEM_POOL_SHARD          (1u << 31)  // a shard, its memory is the parent's
+#define MEM_POOL_INTERNAL_FLAGS \
+        (MEM_POOL_SHARED | MEM_POOL_FILE | MEM_POOL_SHARDED | MEM_POOL_SHARD)
+
+// the pools every call takes the lock of
+#define MEM_POOL_LOCKING        (POOL_BACKGROUND | POOL_LOCKED)
+
+// file-backed pools: the header takes the first page of the file, the
+// pool the rest
+#define MEM_FILE_HDR_SIZE       4096
+#define MEM_FILE_MAGIC          0x4c4f4f504d454d31ULL   // "1MEMPOOL"
+#define MEM_FILE_VERSION        1
 
 
 
@@ -35,27 +175,222 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
+
+// segment offsets and sizes are relative to pool.mem; 64 bits make a
+// node 24 bytes, define MEM_POOL_SMALL_OFFSETS for 16-byte nodes in
+// pools under 1 GiB
+#ifdef MEM_POOL_SMALL_OFFSETS
+typedef uint32_t mem_off_t;
+#else
+typedef uint64_t mem_off_t;
+#endif
+
+// the node flags are packed into the top bits of the size word
+#define NODE_USED       ((mem_off_t) 1 << (sizeof(mem_off_t) * 8 - 1))
+#define NODE_ALLOCATED  ((mem_off_t) 1 << (sizeof(mem_off_t) * 8 - 2))
+#define NODE_SIZE_MASK  (NODE_ALLOCATED - 1)
+#define NODE_NIL        UINT32_MAX
+
+#define MEM_POOL_MAX_SIZE ((size_t) NODE_SIZE_MASK)
+
+// quick list links: not on a quick list, and a quick bin no size has taken
+#define QUICK_NONE      (NODE_NIL - 1)
+#define QUICK_EMPTY     NODE_USED
+
 typedef struct _node {
-    alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
-    struct _node *next, *prev; // doubly-linked list for gap deletion
+    mem_off_t offset;       // segment start, relative to pool.mem
+    mem_off_t size;         // segment size | NODE_USED | NODE_ALLOCATED
+    uint32_t next, prev;    // node heap indices, doubly-linked list for gap deletion
 } node_t, *node_pt;
 
-typedef struct _gap {
-    size_t size;
-    node_pt node;
-} gap_t, *gap_pt;
+// FIRST_FIT pools index their gaps in a treap ordered by address, in
+// which each gap also knows the largest gap in its subtree; the links
+// are kept beside the node heap (entry i belongs to node i)
+// define MEM_FIRST_FIT_GAP_LIST for the lighter alternative, a plain
+// doubly-linked list of the gaps in address order
+#ifndef MEM_FIRST_FIT_GAP_LIST
+typedef struct _gap_link {
+    uint32_t left, right;
+    mem_off_t max;          // largest gap size in the subtree
+} gap_link_t, *gap_link_pt;
+#else
+typedef struct _gap_link {
+    uint32_t next, prev;    // neighboring gaps
+} gap_link_t, *gap_link_pt;
+#endif
+
+// POOL_DEFERRED_COALESCING: freed blocks of one exact size, linked
+// through the quick links beside the node heap
+typedef struct _quick_bin {
+    mem_off_t size;         // QUICK_EMPTY until a size takes the bin
+    uint32_t head;
+} quick_bin_t, *quick_bin_pt;
+
+// POOL_BACKGROUND: how long each gap has been free, beside the node heap
+typedef struct _gap_age {
+    mem_off_t purged;       // bytes of the gap purged
+    uint32_t since;         // when the gap last grew, on the maintenance clock
+    uint32_t dirty;         // it has grown since it was purged
+} gap_age_t, *gap_age_pt;
+
+struct _pool_mgr;
+
+// allocation records are kept out of the node heap, in aligned chunks
+// that never move, so an alloc_pt stays valid when the node heap grows
+// and the owning node is found from the record address alone
+typedef struct _alloc_chunk {
+    struct _pool_mgr *pool_mgr;
+    uint32_t base;          // node index of records[0]
+    alloc_t records[];
+} alloc_chunk_t, *alloc_chunk_pt;
+
+#define MEM_ALLOC_CHUNK_RECORDS \
+    ((MEM_ALLOC_CHUNK_SIZE - sizeof(alloc_chunk_t)) / sizeof(alloc_t))
+
+// boundary-tag blocks: a header with the record (or the gap list links),
+// the payload, and a footer repeating the tag for the block behind it
+#define TAG_ALLOCATED   ((size_t) 1)
+#define TAG_NIL         SIZE_MAX
+#define TAG_MIN_BLOCK   MEM_TAG_BLOCK_SIZE(0)
+
+// the gap tree links and the lowest gap offset of the subtree, in 8-byte
+// words, fill the two words of the record: a pool with boundary tags can
+// be as large as TAG_MAX_SIZE
+#define TAG_LINK_NIL    (((uint64_t) 1 << 42) - 1)
+#define TAG_MAX_SIZE    ((size_t) (TAG_LINK_NIL * sizeof(size_t)))
+
+typedef struct _tag_hdr {
+    size_t tag;             // block size | TAG_ALLOCATED
+    union {
+        alloc_t alloc_record;
+        struct {
+            uint64_t left : 42, min_low : 22;   // the gap tree, and the
+            uint64_t right : 42, min_high : 22; //   subtree's lowest gap
+        } gap;
+    };
+} tag_hdr_t, *tag_hdr_pt;
+
+// MEM_POOL_FILE: the header of the file; the counters are those of the
+// pool_mgr at the last close, valid only while clean is set
+// MEM_POOL_SHARED: the counters are always valid, under the lock
+typedef struct _file_hdr {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t total_size;
+    uint64_t clean;         // 1 after a clean close, 0 while the pool is open
+    uint64_t base;          // address pool.mem was mapped at
+    uint64_t tag_root;
+    uint64_t used_nodes;
+    uint64_t alloc_size;
+    uint64_t num_allocs;
+    uint64_t num_gaps;
+    uint64_t root;          // offset of the root block, TAG_NIL if none
+    pthread_mutex_t lock;   // MEM_POOL_SHARED: process-shared and robust
+} file_hdr_t, *file_hdr_pt;
+
+// MEM_POOL_SHARED: the record of a block, in this process; the header of
+// the block, in the shared mapping, holds the size only, never an address
+typedef struct _shared_record {
+    alloc_t alloc_record;   // mem is in this process's mapping
+    size_t offset;          // of the block's header in the pool
+    struct _shared_record *next;
+} shared_record_t, *shared_record_pt;
+
+// an allocated node by its offset, in the offset index of a pool
+typedef struct _offset_entry {
+    mem_off_t offset;
+    uint32_t node;          // NODE_NIL: an empty entry
+} offset_entry_t, *offset_entry_pt;
+
+// the address range of an open pool
+typedef struct _pool_range {
+    char *start;
+    char *end;
+    struct _pool_mgr *mgr;
+} pool_range_t, *pool_range_pt;
+
+// a slot of the pool store; the generation is odd while a pool is in it
+typedef struct _pool_slot {
+    struct _pool_mgr *mgr;
+    unsigned gen;
+    unsigned next_free;     // the free-slot list, while the slot is empty
+} pool_slot_t, *pool_slot_pt;
+
+#define POOL_SLOT_NIL   UINT32_MAX
+
+// a pool store, with its own lock and lifecycle
+struct _mem_context {
+    pool_slot_pt pool_store;        // an array of slots, only expand
+    unsigned pool_store_size;       // slots ever taken, free ones are reused
+    unsigned pool_store_capacity;
+    unsigned pool_store_free;       // the first free slot
+    // the maintenance thread walks the pool store, open and close change it
+    pthread_mutex_t lock;
+    unsigned maint_cursor;          // the pool the next pass starts at
+    struct _mem_context *next;      // the list of all contexts
+};
 
 typedef struct _pool_mgr {
     pool_t pool;
+    unsigned flags;
     node_pt node_heap;
     unsigned total_nodes;
     unsigned used_nodes;
-    gap_pt gap_ix;
+    uint32_t free_node;     // stack of unused nodes, linked through next
+    mem_off_t *gap_sizes;   // BEST_FIT: gaps sorted by size, then address,
+    uint32_t *gap_nodes;    //   split in a size array and a node array
     unsigned gap_ix_capacity;
+    gap_link_pt gap_links;  // FIRST_FIT: gaps in a treap ordered by address
+    uint32_t gap_root;      //   (or list head, MEM_FIRST_FIT_GAP_LIST)
+    uint32_t gap_hint;      //   list position of the last removed gap
+    alloc_chunk_pt *alloc_chunks;
+    unsigned num_alloc_chunks;
+    size_t tag_root;        // POOL_BOUNDARY_TAGS: offset of the root of the gap tree
+    pthread_t owner;        // POOL_OWNER_THREAD: the allocating thread
+    _Atomic(alloc_pt) remote_frees; // records freed by other threads
+    struct _pool_mgr **shards;  // MEM_POOL_SHARDED: the shards in address order
+    unsigned num_shards;
+    size_t shard_size;      //   all but the last shard have this size
+    pthread_mutex_t lock;   // MEM_POOL_SHARD, MEM_POOL_LOCKING: serializes the pool
+    _Atomic unsigned seq;   // odd while a writer changes the pool
+    node_pt retired_heaps;  // node heaps readers may still be walking
+    quick_bin_pt quick_bins;    // POOL_DEFERRED_COALESCING: open addressing by size
+    uint32_t *quick_links;  //   next on the quick list, beside the node heap
+    unsigned num_quick;     //   gaps on quick lists, not in the gap index
+    unsigned maint_seq;     // POOL_BACKGROUND: seq at the last maintenance pass
+    unsigned purged_seq;    //   seq at the last purge of the gaps
+    gap_age_pt gap_ages;    //   since when each gap is free, beside the node heap
+    int decay_pending;      //   gaps were left to decay at the last purge
+    int numa_node;          // POOL_NUMA_NODE: the pool's node, -1 if not placed
+    file_hdr_pt file;       // MEM_POOL_FILE: the header, at the start of the mapping
+    size_t committed;       // POOL_RESERVE: [0, committed) is read/write
+    offset_entry_pt offset_ix;  // allocated nodes by offset, open addressing,
+    unsigned offset_ix_capacity;    //   built on the first free by address
+    unsigned offset_ix_count;
+    mem_context_pt ctx;     // the context the pool is open in
+    unsigned slot;          // the pool's slot in its pool store
+    size_t granularity;     // block sizes are multiples of it (1: exact)
+    size_t min_split;       //   a smaller remainder of a gap goes with the block
+    size_t requested_size;  //   the bytes asked for, alloc_size is what they take
+    shared_record_pt *shared_records;   // MEM_POOL_SHARED: this process's records,
+    unsigned shared_records_capacity;   //   chained by block offset
+    unsigned shared_records_count;
 } pool_mgr_t, *pool_mgr_pt;
 
+// the memory policy of the calling thread, while it allocates metadata
+typedef struct _numa_policy {
+    int placed;             // 0 if the policy was left alone
+    int mode;
+    unsigned long mask;
+} numa_policy_t;
+
+// the nodes fit in one word of node mask (the kernel reads one bit less)
+#define MEM_NUMA_MAX_NODES  (sizeof(unsigned long) * 8)
+#define MEM_NUMA_MASK_BITS  (MEM_NUMA_MAX_NODES + 1)
+
+// a single load of a field a writer may be changing, for seqlock readers
+#define MEM_READ_ONCE(x) (*(volatile __typeof__(x) *) &(x))
+
 
 
 /***************************/
@@ -63,9 +398,29 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+// the pool store of mem_init() and mem_free(), and the pools they open
+static mem_context_t default_context = {
+        NULL, 0, 0, POOL_SLOT_NIL, PTHREAD_MUTEX_INITIALIZER, 0, NULL
+};
+// the list of all contexts, for the maintenance thread to walk
+static mem_context_pt contexts = &default_context;
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the address ranges of all open pools, sorted, see mem_free_ptr()
+static pool_range_pt pool_ranges = NULL;
+static unsigned num_pool_ranges = 0;
+static unsigned pool_ranges_capacity = 0;
+static pthread_rwlock_t pool_ranges_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// the maintenance thread, see mem_maintenance_start()
+static pthread_t maint_thread;
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static int maint_running = 0;
+static int maint_stop = 0;
+static int maint_woken = 0;
+static maint_opts_t maint_opts;
+static _Atomic unsigned maint_clock = 0;    // ms, set at the start of every pass
 
 
 
@@ -74,19 +429,195 @@ static unsigned pool_store_capacity = 0;
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_context_init(mem_context_pt ctx);
+static void _mem_context_close(mem_context_pt ctx);
+static alloc_status _mem_resize_pool_store(mem_context_pt ctx);
+static alloc_status _mem_pool_store_add(mem_context_pt ctx, pool_mgr_pt pool_mgr);
+static void _mem_pool_store_remove(pool_mgr_pt pool_mgr);
+static pool_mgr_pt _mem_pool_create(size_t size, alloc_policy policy, unsigned flags,
+                                    int numa_node, char *mem);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
+static alloc_status _mem_grow_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_grow_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                            size_t size,
-                           node_pt node);
+                           uint32_t node);
 static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
-                                node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
-static node_pt mergeGaps(pool_mgr_pt poolManager, node_pt node, node_pt nextNode);
+                                uint32_t node);
+static unsigned _mem_search_gap_ix(pool_mgr_pt pool_mgr, size_t size, mem_off_t offset);
+static uint32_t mergeGaps(pool_mgr_pt poolManager, uint32_t node, uint32_t nextNode);
+static uint32_t _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, uint32_t node);
+static alloc_pt _mem_get_alloc_record(pool_mgr_pt pool_mgr, uint32_t node);
+static void _mem_free_pool_mgr(pool_mgr_pt pool_mgr);
+#ifndef MEM_FIRST_FIT_GAP_LIST
+static uint32_t _mem_gap_tree_insert(pool_mgr_pt pool_mgr, uint32_t root, uint32_t node);
+static uint32_t _mem_gap_tree_remove(pool_mgr_pt pool_mgr, uint32_t root, uint32_t node);
+static uint32_t _mem_gap_tree_first_fit(pool_mgr_pt pool_mgr, size_t size);
+#else
+static void _mem_gap_list_insert(pool_mgr_pt pool_mgr, uint32_t node);
+static void _mem_gap_list_remove(pool_mgr_pt pool_mgr, uint32_t node);
+static uint32_t _mem_gap_list_first_fit(pool_mgr_pt pool_mgr, size_t size);
+#endif
+static alloc_status _mem_tag_init(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_tag_new_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tag_del_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_pt _mem_tag_alloc_at(pool_mgr_pt pool_mgr, size_t offset);
+static unsigned _mem_tag_read_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                       unsigned capacity);
+static unsigned _mem_node_read_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                        unsigned capacity);
+static alloc_pt _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_inspect_pool(pool_mgr_pt pool_mgr, pool_segment_pt *segments,
+                              unsigned *num_segments);
+static uint32_t _mem_find_gap(pool_mgr_pt pool_mgr, size_t size);
+static size_t _mem_block_size(pool_mgr_pt pool_mgr, size_t size);
+static size_t _mem_requested_size(pool_mgr_pt pool_mgr);
+static int _mem_quick_push(pool_mgr_pt pool_mgr, uint32_t node);
+static uint32_t _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_coalesce(pool_mgr_pt pool_mgr);
+static void *_mem_maint_main(void *arg);
+static void _mem_fork_lock_pools(mem_context_pt ctx, int lock);
+static void _mem_fork_release();
+static unsigned _mem_maintain_pool(pool_mgr_pt pool_mgr);
+static void _mem_purge_gaps(pool_mgr_pt pool_mgr);
+static int _mem_decay_gaps(pool_mgr_pt pool_mgr, unsigned now);
+static void _mem_trim_pool(pool_mgr_pt pool_mgr);
+static int _mem_numa_local_node();
+static void _mem_numa_bind(char *mem, size_t size, int *numa_node);
+static alloc_status _mem_commit(pool_mgr_pt pool_mgr, size_t end);
+static void _mem_numa_enter(int numa_node, numa_policy_t *saved);
+static void _mem_numa_leave(const numa_policy_t *saved);
+static char *_mem_file_map(int fd, size_t *size, int create);
+static alloc_status _mem_file_recover(pool_mgr_pt pool_mgr);
+static void _mem_file_save(pool_mgr_pt pool_mgr);
+static alloc_status _mem_file_set_root(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_pt _mem_file_get_root(pool_mgr_pt pool_mgr);
+static pool_pt _mem_file_register(pool_mgr_pt pool_mgr);
+static alloc_status _mem_range_add(pool_mgr_pt pool_mgr);
+static void _mem_range_remove(pool_mgr_pt pool_mgr);
+static pool_mgr_pt _mem_range_find(const char *mem);
+static void _mem_offset_ix_add(pool_mgr_pt pool_mgr, uint32_t node);
+static void _mem_offset_ix_remove(pool_mgr_pt pool_mgr, uint32_t node);
+static uint32_t _mem_offset_ix_find(pool_mgr_pt pool_mgr, size_t offset);
+static alloc_status _mem_ptr_block(pool_mgr_pt pool_mgr, void *ptr, size_t known, size_t *size);
+static alloc_status _mem_shared_lock(pool_mgr_pt pool_mgr);
+static void _mem_shared_unlock(pool_mgr_pt pool_mgr);
+static void _mem_shared_save(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_shared_record(pool_mgr_pt pool_mgr, size_t offset);
+static size_t _mem_shared_record_offset(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_shared_record_drop(pool_mgr_pt pool_mgr, size_t offset);
+static void _mem_shared_records_free(pool_mgr_pt pool_mgr);
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_push_remote_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_drain_remote_frees(pool_mgr_pt pool_mgr);
+static alloc_status _mem_sharded_close(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_sharded_new_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_sharded_del_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static pool_mgr_pt _mem_shard_of(pool_mgr_pt pool_mgr, const char *mem);
+static void _mem_sharded_inspect_pool(pool_mgr_pt pool_mgr, pool_segment_pt *segments,
+                                      unsigned *num_segments);
+
+
+
+/*****************************/
+/*                           */
+/* Node accessors            */
+/*                           */
+/*****************************/
+static inline size_t _node_size(const node_t *node) {
+    return node->size & NODE_SIZE_MASK;
+}
+
+static inline int _node_is_gap(const node_t *node) {
+    return (node->size & (NODE_USED | NODE_ALLOCATED)) == NODE_USED;
+}
+
+static inline int _node_is_allocated(const node_t *node) {
+    return (node->size & NODE_ALLOCATED) != 0;
+}
+
+static inline void _node_set(node_t *node, size_t size, int allocated) {
+    node->size = (mem_off_t) size | NODE_USED | (allocated ? NODE_ALLOCATED : 0);
+}
+
+// the gaps on quick lists count as gaps, but aren't in the gap index
+static inline unsigned _mem_gap_ix_size(pool_mgr_pt pool_mgr) {
+    return pool_mgr->pool.num_gaps - pool_mgr->num_quick;
+}
+
+
+
+/*****************************/
+/*                           */
+/* Gap ages                  */
+/*                           */
+/*****************************/
+// POOL_BACKGROUND node-heap pools; no-ops elsewhere
+
+static inline void _mem_purged_add(pool_mgr_pt pool_mgr, ptrdiff_t bytes) {
+    pool_mgr->pool.purged_size += bytes;
+    pool_mgr->pool.resident_size -= bytes;
+}
+
+// the gap at node grew, at since; it has no purged pages of its own yet
+static inline void _mem_gap_age_set(pool_mgr_pt pool_mgr, uint32_t node, unsigned since) {
+    if(pool_mgr->gap_ages != NULL) {
+        pool_mgr->gap_ages[node].purged = 0;
+        pool_mgr->gap_ages[node].since = since;
+        pool_mgr->gap_ages[node].dirty = 1;
+    }
+}
+
+// the gap at node is allocated: its pages come back on the first touch
+static inline void _mem_gap_age_take(pool_mgr_pt pool_mgr, uint32_t node) {
+    if(pool_mgr->gap_ages != NULL) {
+        _mem_purged_add(pool_mgr, -(ptrdiff_t) pool_mgr->gap_ages[node].purged);
+        pool_mgr->gap_ages[node].purged = 0;
+    }
+}
+
+static inline unsigned _mem_gap_age_now() {
+    return atomic_load_explicit(&maint_clock, memory_order_relaxed);
+}
+
+
+
+/*****************************/
+/*                           */
+/* Seqlock                   */
+/*                           */
+/*****************************/
+// a writer (one at a time per pool) makes the sequence odd while it
+// changes the pool; readers copy what they need and start over if the
+// sequence was odd or has moved, so neither side ever waits on the other
+static inline void _mem_write_begin(pool_mgr_pt pool_mgr) {
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void _mem_write_end(pool_mgr_pt pool_mgr) {
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    atomic_store_explicit(&pool_mgr->seq, seq + 1, memory_order_release);
+}
+
+static inline unsigned _mem_read_begin(pool_mgr_pt pool_mgr) {
+    unsigned seq;
+    while((seq = atomic_load_explicit(&pool_mgr->seq, memory_order_acquire)) & 1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+static inline int _mem_read_retry(pool_mgr_pt pool_mgr, unsigned seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed) != seq;
+}
 
 
 
@@ -97,547 +628,3402 @@ static node_pt mergeGaps(pool_mgr_pt poolManager, node_pt node, node_pt nextNode
 /****************************************/
 alloc_status mem_init() {
     // ensure that it's called only once until mem_free
-    if(pool_store != NULL) {
+    if(default_context.pool_store != NULL) {
         return ALLOC_CALLED_AGAIN;
     }
-    // allocate the pool store with initial capacity
-    // note: holds pointers only, other functions to allocate/deallocate
-    else {
-        pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-        pool_store = calloc(pool_store_capacity, sizeof(pool_mgr_pt));
-        return ALLOC_OK;
-    }
+    // allocate the pool store of the default context
+    return _mem_context_init(&default_context);
 }
 
 alloc_status mem_free() {
     // ensure that it's called only once for each mem_init
-    if(pool_store == NULL) {
+    if(default_context.pool_store == NULL) {
         return ALLOC_CALLED_AGAIN;
     }
-    // make sure all pool managers have been deallocated
-    for(int i = 0; i < pool_store_size; i++) {
-        if(pool_store[i] != NULL) {
-            mem_pool_close((pool_pt) pool_store[i]);
-        }
+    // the maintenance thread goes first, it walks the pool stores
+    mem_maintenance_stop();
+    // close the pools of the default context and free its pool store
+    _mem_context_close(&default_context);
+    return ALLOC_OK;
+}
+
+mem_context_pt mem_context_create() {
+    mem_context_pt ctx = (mem_context_pt) calloc(1, sizeof(mem_context_t));
+    if(ctx == NULL) {
+        return NULL;
     }
-    // can free the pool store array
-    free(pool_store);
-    // update static variables
-    pool_store = NULL;
-    pool_store_capacity = 0;
-    pool_store_size = 0;
+    if(pthread_mutex_init(&ctx->lock, NULL) != 0) {
+        free(ctx);
+        return NULL;
+    }
+    if(_mem_context_init(ctx) != ALLOC_OK) {
+        pthread_mutex_destroy(&ctx->lock);
+        free(ctx);
+        return NULL;
+    }
+    // let the maintenance thread see its pools
+    pthread_mutex_lock(&contexts_lock);
+    ctx->next = contexts;
+    contexts = ctx;
+    pthread_mutex_unlock(&contexts_lock);
+    return ctx;
+}
+
+alloc_status mem_context_destroy(mem_context_pt ctx) {
+    if(ctx == NULL || ctx == &default_context) {
+        return ALLOC_FAIL;
+    }
+    // unlink it first, so the maintenance thread is done with it
+    pthread_mutex_lock(&contexts_lock);
+    mem_context_pt *link = &contexts;
+    while(*link != ctx) {
+        link = &(*link)->next;
+    }
+    *link = ctx->next;
+    pthread_mutex_unlock(&contexts_lock);
+    // close all of its pools, whatever is left allocated
+    _mem_context_close(ctx);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
     return ALLOC_OK;
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
-    //printf("mem_pool_open\n");
+    return mem_pool_open_opts(size, policy, NULL);
+}
+
+pool_pt mem_pool_open_opts(size_t size, alloc_policy policy, const pool_opts_t *opts) {
+    return mem_pool_open_in(&default_context, size, policy, opts);
+}
+
+pool_pt mem_pool_open_in(mem_context_pt ctx, size_t size, alloc_policy policy, const pool_opts_t *opts) {
+    unsigned flags = (opts != NULL) ? opts->flags & ~MEM_POOL_INTERNAL_FLAGS : POOL_DEFAULT;
+    // the maintenance thread does the merging for the pools it maintains
+    if(flags & POOL_BACKGROUND) {
+        flags |= POOL_DEFERRED_COALESCING;
+    }
     // make sure there the pool store is allocated
-    if(pool_store == NULL) {
+    if(ctx == NULL || ctx->pool_store == NULL) {
         return NULL;
     }
-    // expand the pool store, if necessary
-    _mem_resize_pool_store();
-    // allocate a new mem pool mgr
-    pool_mgr_pt memPoolMgr = (pool_mgr_pt) malloc(sizeof(pool_mgr_t));
+    // the granularity is a power of 2, 1 by default
+    size_t granularity = (opts != NULL && opts->granularity != 0) ? opts->granularity : 1;
+    if((granularity & (granularity - 1)) != 0 || granularity > MEM_MAX_GRANULARITY) {
+        return NULL;
+    }
+    // a NUMA pool's metadata is allocated on its node too
+    int numaNode = -1;
+    numa_policy_t saved;
+    if(flags & POOL_NUMA_NODE) {
+        numaNode = (opts->numa_node == POOL_NUMA_LOCAL) ? _mem_numa_local_node() : opts->numa_node;
+        if(numaNode < 0 || numaNode >= (int) MEM_NUMA_MAX_NODES) {
+            numaNode = -1;
+        }
+    }
+    _mem_numa_enter(numaNode, &saved);
+    // allocate a new mem pool mgr with its memory pool
     // check success, on error return null
+    pool_mgr_pt memPoolMgr = _mem_pool_create(size, policy, flags, numaNode, NULL);
+    _mem_numa_leave(&saved);
     if(memPoolMgr == NULL) {
         return NULL;
     }
-    // allocate a new memory pool
-    memPoolMgr->pool.mem = (char*) malloc(size);
-    // check success, on error deallocate mgr and return null
-    if(memPoolMgr->pool.mem == NULL) {
-        free(memPoolMgr);
+    memPoolMgr->granularity = granularity;
+    memPoolMgr->min_split = (opts != NULL) ? opts->min_split : 0;
+    // link pool mgr to pool store
+    if(_mem_pool_store_add(ctx, memPoolMgr) != ALLOC_OK) {
+        _mem_free_pool_mgr(memPoolMgr);
         return NULL;
     }
-    // allocate a new node heap
-    memPoolMgr->node_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-    // check success, on error deallocate mgr/pool and return null
-    if(memPoolMgr->node_heap == NULL) {
-        free(memPoolMgr->pool.mem);
-        free(memPoolMgr);
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt) memPoolMgr;
+}
+
+pool_pt mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards) {
+    // make sure there the pool store is allocated and every shard gets memory
+    if(default_context.pool_store == NULL || num_shards == 0 || size < num_shards) {
         return NULL;
     }
-    // allocate a new gap index
-    memPoolMgr->gap_ix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-    memPoolMgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-    // check success, on error deallocate mgr/pool/heap and return null
-    if(memPoolMgr->gap_ix == NULL) {
-        free(memPoolMgr->node_heap);
-        free(memPoolMgr->pool.mem);
-        free(memPoolMgr);
+    // allocate the mgr of the whole pool, which only holds the shards
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if(memPoolMgr == NULL) {
         return NULL;
     }
-    // assign all the pointers and update meta data:
-    //   initialize top node of node heap
-    memPoolMgr->node_heap[0].alloc_record.mem = memPoolMgr->pool.mem;
-    memPoolMgr->node_heap[0].alloc_record.size = size;
-    memPoolMgr->node_heap[0].allocated = 0;
-    memPoolMgr->node_heap[0].used = 1;
-    memPoolMgr->node_heap[0].next = NULL;
-    memPoolMgr->node_heap[0].prev = NULL;
-    //   initialize top node of gap index
-    memPoolMgr->gap_ix[0].node = memPoolMgr->node_heap;
-    memPoolMgr->gap_ix[0].size = size;
-    //   initialize pool mgr
-    memPoolMgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-    memPoolMgr->used_nodes = 1;
+    memPoolMgr->flags = MEM_POOL_SHARDED;
     memPoolMgr->pool.total_size = size;
-    memPoolMgr->pool.alloc_size = 0;
-    memPoolMgr->pool.num_allocs = 0;
-    memPoolMgr->pool.num_gaps = 1;
+    memPoolMgr->pool.resident_size = size;
     memPoolMgr->pool.policy = policy;
-    //   link pool mgr to pool store
-    pool_store[pool_store_size] = memPoolMgr;
-    pool_store_size++;
-    // return the address of the mgr, cast to (pool_pt)
+    memPoolMgr->pool.num_gaps = num_shards;
+    memPoolMgr->pool.mem = (char*) malloc(size);
+    memPoolMgr->shards = (pool_mgr_pt*) calloc(num_shards, sizeof(pool_mgr_pt));
+    if(memPoolMgr->pool.mem == NULL || memPoolMgr->shards == NULL) {
+        _mem_sharded_close(memPoolMgr);
+        return NULL;
+    }
+    // carve the memory into shards, the last one takes the remainder
+    memPoolMgr->shard_size = size / num_shards;
+    for(unsigned i = 0; i < num_shards; i++) {
+        size_t shardSize = (i + 1 < num_shards) ? memPoolMgr->shard_size
+                                                : size - i * memPoolMgr->shard_size;
+        pool_mgr_pt shard = _mem_pool_create(shardSize, policy, MEM_POOL_SHARD, -1,
+                                             memPoolMgr->pool.mem + i * memPoolMgr->shard_size);
+        if(shard == NULL) {
+            _mem_sharded_close(memPoolMgr);
+            return NULL;
+        }
+        memPoolMgr->shards[i] = shard;
+        memPoolMgr->num_shards++;
+    }
+    // link pool mgr to pool store
+    if(_mem_pool_store_add(&default_context, memPoolMgr) != ALLOC_OK) {
+        _mem_sharded_close(memPoolMgr);
+        return NULL;
+    }
     return (pool_pt) memPoolMgr;
 }
 
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+    // make sure there the pool store is allocated
+    if(default_context.pool_store == NULL) {
+        return NULL;
+    }
+    // map the file, creating the pool if the file is new
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    int created = (fstat(fd, &st) == 0 && st.st_size == 0);
+    char *map = _mem_file_map(fd, &size, created);
+    // the mapping keeps the file
+    close(fd);
+    if(map == NULL) {
+        return NULL;
+    }
+    // the pool follows the header; it keeps its metadata in boundary tags
+    pool_mgr_pt memPoolMgr = _mem_pool_create(size, policy, POOL_BOUNDARY_TAGS | MEM_POOL_FILE, -1,
+                                              map + MEM_FILE_HDR_SIZE);
+    if(memPoolMgr == NULL) {
+        munmap(map, MEM_FILE_HDR_SIZE + size);
+        return NULL;
+    }
+    memPoolMgr->file = (file_hdr_pt) map;
+    file_hdr_pt hdr = memPoolMgr->file;
+    alloc_status status = ALLOC_OK;
+    // a new file is formatted; a cleanly closed one mapped at the same
+    // address is taken as it is; anything else is scanned
+    if(created) {
+        status = _mem_tag_init(memPoolMgr);
+        hdr->root = TAG_NIL;
+    }
+    else if(hdr->clean && hdr->base == (uintptr_t) memPoolMgr->pool.mem) {
+        memPoolMgr->tag_root = hdr->tag_root;
+        memPoolMgr->used_nodes = hdr->used_nodes;
+        memPoolMgr->pool.alloc_size = hdr->alloc_size;
+        memPoolMgr->pool.num_allocs = hdr->num_allocs;
+        memPoolMgr->pool.num_gaps = hdr->num_gaps;
+    }
+    else {
+        status = _mem_file_recover(memPoolMgr);
+    }
+    if(status != ALLOC_OK) {
+        _mem_free_pool_mgr(memPoolMgr);
+        return NULL;
+    }
+    // until it's closed, a reopen has to recover the pool
+    hdr->clean = 0;
+    hdr->base = (uintptr_t) memPoolMgr->pool.mem;
+    hdr->magic = MEM_FILE_MAGIC;
+    msync(map, MEM_FILE_HDR_SIZE, MS_SYNC);
+    return _mem_file_register(memPoolMgr);
+}
+
+pool_pt mem_pool_open_shared(const char *name, size_t size, alloc_policy policy) {
+    // make sure there the pool store is allocated
+    if(default_context.pool_store == NULL) {
+        return NULL;
+    }
+    // a named pool is created by the first process to open it, the
+    // others attach to it; an anonymous one is inherited by fork()
+    int fd;
+    int created = 1;
+    if(name == NULL) {
+        fd = memfd_create("mem_pool", 0);
+    }
+    else {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd < 0 && errno == EEXIST) {
+            created = 0;
+            fd = shm_open(name, O_RDWR, 0);
+        }
+    }
+    if(fd < 0) {
+        return NULL;
+    }
+    char *map = _mem_file_map(fd, &size, created);
+    close(fd);
+    if(map == NULL) {
+        if(created && name != NULL) {
+            shm_unlink(name);
+        }
+        return NULL;
+    }
+    pool_mgr_pt memPoolMgr = _mem_pool_create(size, policy,
+                                              POOL_BOUNDARY_TAGS | MEM_POOL_FILE | MEM_POOL_SHARED, -1,
+                                              map + MEM_FILE_HDR_SIZE);
+    if(memPoolMgr == NULL) {
+        munmap(map, MEM_FILE_HDR_SIZE + size);
+        return NULL;
+    }
+    memPoolMgr->file = (file_hdr_pt) map;
+    file_hdr_pt hdr = memPoolMgr->file;
+    // the creator formats the pool and publishes it with the magic, last
+    if(created) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int rc = pthread_mutex_init(&hdr->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if(rc != 0 || _mem_tag_init(memPoolMgr) != ALLOC_OK) {
+            _mem_free_pool_mgr(memPoolMgr);
+            return NULL;
+        }
+        hdr->root = TAG_NIL;
+        _mem_shared_save(memPoolMgr);
+        atomic_thread_fence(memory_order_release);
+        hdr->magic = MEM_FILE_MAGIC;
+    }
+    return _mem_file_register(memPoolMgr);
+}
+
 alloc_status mem_pool_close(pool_pt pool) {
-    //printf("mem_pool_close\n");
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    mem_context_pt ctx = memPoolMgr->ctx;
+    // keep the maintenance thread away from the pool while it closes
+    // (a pool mem_free() left open is in no pool store anymore)
+    if(ctx != NULL) {
+        pthread_mutex_lock(&ctx->lock);
+    }
+    // take back the blocks other threads have freed
+    if(memPoolMgr->flags & POOL_OWNER_THREAD) {
+        _mem_drain_remote_frees(memPoolMgr);
+    }
+    // merge the blocks waiting on quick lists
+    if(memPoolMgr->num_quick > 0) {
+        _mem_write_begin(memPoolMgr);
+        _mem_coalesce(memPoolMgr);
+        _mem_write_end(memPoolMgr);
+    }
+    alloc_status status = ALLOC_OK;
+    // a file-backed pool keeps its allocations in the file (a shared
+    // pool is left to the other processes as it is)
+    if(memPoolMgr->flags & MEM_POOL_FILE) {
+        if(!(memPoolMgr->flags & MEM_POOL_SHARED)) {
+            _mem_file_save(memPoolMgr);
+        }
+    }
+    // a sharded pool is freed when all of its shards are
+    else if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        for(unsigned i = 0; i < memPoolMgr->num_shards; i++) {
+            if(memPoolMgr->shards[i]->pool.num_allocs != 0) {
+                status = ALLOC_NOT_FREED;
+            }
+        }
+    }
     // check if this pool is allocated
-    if(memPoolMgr->pool.alloc_size != 0) {
-        return ALLOC_NOT_FREED;
+    else if(memPoolMgr->pool.alloc_size != 0) {
+        status = ALLOC_NOT_FREED;
     }
     // check if pool has only one gap
-    if(memPoolMgr->pool.num_gaps != 1) {
-        return ALLOC_NOT_FREED;
+    else if(memPoolMgr->pool.num_gaps != 1) {
+        status = ALLOC_NOT_FREED;
     }
     // check if it has zero allocations
-    if(memPoolMgr->pool.num_allocs != 0) {
-        return ALLOC_NOT_FREED;
-    }
-    // free memory pool
-    free(memPoolMgr->pool.mem);
-    // free node heap
-    free(memPoolMgr->node_heap);
-    // free gap index
-    free(memPoolMgr->gap_ix);
-    // find mgr in pool store and set to null
-    // note: don't decrement pool_store_size, because it only grows
-    for(int i = 0; i < pool_store_size; i++) {
-        if(pool_store[i] == memPoolMgr) {
-            pool_store[i] = NULL;
-        }
-    }
-    // free mgr
-    free(memPoolMgr);
+    else if(memPoolMgr->pool.num_allocs != 0) {
+        status = ALLOC_NOT_FREED;
+    }
+    if(status != ALLOC_OK) {
+        if(ctx != NULL) {
+            pthread_mutex_unlock(&ctx->lock);
+        }
+        return status;
+    }
+    // free the mgr's slot in the pool store, for the next pool to take
+    if(ctx != NULL) {
+        _mem_pool_store_remove(memPoolMgr);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    // free memory pool, node heap, gap index, allocation records and mgr
+    if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        return _mem_sharded_close(memPoolMgr);
+    }
+    _mem_free_pool_mgr(memPoolMgr);
     return ALLOC_OK;
 }
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
-    //printf("mem_new_alloc\n");
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        return _mem_sharded_new_alloc(memPoolMgr, size);
+    }
+    // only the owner allocates; it takes back the blocks other threads
+    // have freed in the meantime in one batch
+    if((memPoolMgr->flags & POOL_OWNER_THREAD) &&
+       !pthread_equal(pthread_self(), memPoolMgr->owner)) {
+        return NULL;
+    }
+    // the maintenance thread, or other threads, work on the pool between calls
+    if(memPoolMgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_lock(&memPoolMgr->lock);
+    }
+    // other processes work on a shared pool between calls
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return NULL;
+    }
+    if(memPoolMgr->flags & POOL_OWNER_THREAD) {
+        _mem_drain_remote_frees(memPoolMgr);
+    }
+    _mem_write_begin(memPoolMgr);
+    alloc_pt alloc = _mem_new_alloc(memPoolMgr, size);
+    _mem_write_end(memPoolMgr);
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
+    }
+    if(memPoolMgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_unlock(&memPoolMgr->lock);
+    }
+    return alloc;
+}
+
+static alloc_pt _mem_new_alloc(pool_mgr_pt memPoolMgr, size_t request) {
     // check if any gaps, return null if none
     if(memPoolMgr->pool.num_gaps == 0) {
         return NULL;
     }
+    if(memPoolMgr->flags & POOL_BOUNDARY_TAGS) {
+        return _mem_tag_new_alloc(memPoolMgr, request);
+    }
+    if(request > MEM_POOL_MAX_SIZE) {
+        return NULL;
+    }
+    // the block may be larger than asked for
+    size_t size = _mem_block_size(memPoolMgr, request);
+    if(size > MEM_POOL_MAX_SIZE) {
+        return NULL;
+    }
     // expand heap node, if necessary, quit on error
-    assert(_mem_resize_node_heap(memPoolMgr) == ALLOC_OK);
-    // check used nodes fewer than total nodes, quit on error
-    assert(memPoolMgr->total_nodes > memPoolMgr->used_nodes);
-    // get a node for allocation:
-    node_pt node = NULL;
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if(memPoolMgr->pool.policy == FIRST_FIT) {
-        node_pt currentNode= memPoolMgr->node_heap;
-        while(currentNode != NULL) {
-            if(currentNode->allocated == 0 && currentNode->alloc_record.size >= size && currentNode->used == 1) {
-                node = currentNode;
-                currentNode = NULL;
-            }
-            else {
-                currentNode = currentNode->next;
-            }
+    if(_mem_resize_node_heap(memPoolMgr) != ALLOC_OK) {
+        return NULL;
+    }
+    node_pt heap = memPoolMgr->node_heap;
+    // deferred coalescing: reuse a freed block of the same size as it is
+    if(memPoolMgr->num_quick > 0) {
+        uint32_t node = _mem_quick_pop(memPoolMgr, size);
+        if(node != NODE_NIL) {
+            alloc_pt record = _mem_get_alloc_record(memPoolMgr, node);
+            _mem_gap_age_take(memPoolMgr, node);
+            _node_set(&heap[node], size, 1);
+            _mem_offset_ix_add(memPoolMgr, node);
+            memPoolMgr->pool.num_allocs++;
+            memPoolMgr->pool.alloc_size += size;
+            memPoolMgr->requested_size += request;
+            record->size = request;
+            record->mem = memPoolMgr->pool.mem + heap[node].offset;
+            return record;
         }
     }
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    else if(memPoolMgr->pool.policy == BEST_FIT) {
-        for(int i = 0; i < memPoolMgr->gap_ix_capacity && node == NULL; i++) {
-            if(memPoolMgr->gap_ix[i].size >= size) {
-                node = memPoolMgr->gap_ix[i].node;
-                if(i < memPoolMgr->gap_ix_capacity - 1 && memPoolMgr->gap_ix[i + 1].size == node->alloc_record.size) {
-                    node_pt currentNode = memPoolMgr->node_heap;
-                    while(currentNode != NULL) {
-                        if(currentNode->used = 1 && currentNode->allocated == 0 && currentNode->alloc_record.size == node->alloc_record.size) {
-                            node = currentNode;
-                            currentNode = NULL;
-                        }
-                        else {
-                            currentNode = currentNode->next;
-                        }
-                    }
-                }
-            }
+    // get a node for allocation
+    uint32_t node = _mem_find_gap(memPoolMgr, size);
+    // nothing fits: merge the quick blocks and look again
+    if(node == NODE_NIL && memPoolMgr->num_quick > 0) {
+        if(_mem_coalesce(memPoolMgr) != ALLOC_OK) {
+            return NULL;
         }
+        node = _mem_find_gap(memPoolMgr, size);
     }
     // check if node found
-    if(node == NULL) {
+    if(node == NODE_NIL) {
         return NULL;
     }
-    // update metadata (num_allocs, alloc_size)
-    memPoolMgr->pool.num_allocs++;
-    memPoolMgr->pool.alloc_size += size;
-    // calculate the size of the remaining gap, if any
-    int diff = node->alloc_record.size - size;
-    if(diff == 0) {
-        node->allocated = 1;
-        assert(_mem_remove_from_gap_ix(memPoolMgr, node->alloc_record.size, node) == ALLOC_OK);
+    // a remainder too small to be worth a gap goes with the block
+    size_t gapSize = _node_size(&heap[node]);
+    if(gapSize - size < memPoolMgr->min_split) {
+        size = gapSize;
     }
-    else {
-        node_pt newNode = NULL;
-        for(int i = 0; i < memPoolMgr->total_nodes; i++) {
-            if(memPoolMgr->node_heap[i].used == 0) {
-                newNode = &memPoolMgr->node_heap[i];
-                break;
-            }
-        }
-        assert(newNode != NULL);
-        node->allocated = 1;
-        node->alloc_record.size = size;
-        _mem_remove_from_gap_ix(memPoolMgr, node->alloc_record.size, node);
-        newNode->used = 1;
-        newNode->alloc_record.mem = node->alloc_record.mem + size;
-        newNode->alloc_record.size = diff;
-        _mem_add_to_gap_ix(memPoolMgr, diff, newNode);
-        newNode->next = node->next;
-        if(newNode->next != NULL) {
-            newNode->next->prev = newNode;
-        }
-        node->next = newNode;
-        newNode->prev = node;
+    // make sure the memory is committed
+    if((memPoolMgr->flags & POOL_RESERVE) &&
+       _mem_commit(memPoolMgr, heap[node].offset + size) != ALLOC_OK) {
+        return NULL;
     }
-    if(diff > 0) {
-        memPoolMgr->used_nodes++;
+    // make sure there is a record for the allocation
+    alloc_pt record = _mem_get_alloc_record(memPoolMgr, node);
+    if(record == NULL) {
+        return NULL;
     }
-
     // remove node from gap index
+    if(_mem_remove_from_gap_ix(memPoolMgr, gapSize, node) != ALLOC_OK) {
+        return NULL;
+    }
     // convert gap_node to an allocation node of given size
+    _mem_gap_age_take(memPoolMgr, node);
+    _node_set(&heap[node], size, 1);
+    _mem_offset_ix_add(memPoolMgr, node);
+    // update metadata (num_allocs, alloc_size)
+    memPoolMgr->pool.num_allocs++;
+    memPoolMgr->pool.alloc_size += size;
+    memPoolMgr->requested_size += request;
     // adjust node heap:
     //   if remaining gap, need a new node
-    //   find an unused one in the node heap
-    //   make sure one was found
-    //   initialize it to a gap node
-    //   update metadata (used_nodes)
-    //   update linked list (new node right after the node for allocation)
-    //   add to gap index
-    //   check if successful
-    // return allocation record by casting the node to (alloc_pt)
+    size_t diff = gapSize - size;
+    if(diff > 0) {
+        //   find an unused one in the node heap
+        uint32_t newNode = _mem_get_unused_node(memPoolMgr);
+        //   make sure one was found (the heap was resized above)
+        assert(newNode != NODE_NIL);
+        //   initialize it to a gap node
+        heap[newNode].offset = heap[node].offset + (mem_off_t) size;
+        _node_set(&heap[newNode], diff, 0);
+        //   it's as old as the gap (its pages may be purged again)
+        if(memPoolMgr->gap_ages != NULL) {
+            _mem_gap_age_set(memPoolMgr, newNode, memPoolMgr->gap_ages[node].since);
+        }
+        //   update metadata (used_nodes)
+        memPoolMgr->used_nodes++;
+        //   update linked list (new node right after the node for allocation)
+        heap[newNode].next = heap[node].next;
+        if(heap[newNode].next != NODE_NIL) {
+            heap[heap[newNode].next].prev = newNode;
+        }
+        heap[node].next = newNode;
+        heap[newNode].prev = node;
+        //   add to gap index
+        //   check if successful
+        if(_mem_add_to_gap_ix(memPoolMgr, diff, newNode) != ALLOC_OK) {
+            return NULL;
+        }
+    }
+    // fill in and return the allocation record
+    record->size = request;
+    record->mem = memPoolMgr->pool.mem + heap[node].offset;
+    return record;
+}
+
+// the size of the block for a request: a multiple of the granularity
+// and, with POOL_SIZE_CLASSES, past MEM_SIZE_CLASS_LINEAR granules, a
+// multiple of a fraction of the power of 2 below it
+static size_t _mem_block_size(pool_mgr_pt pool_mgr, size_t size) {
+    size_t step = pool_mgr->granularity;
+    if((pool_mgr->flags & POOL_SIZE_CLASSES) && size > step * MEM_SIZE_CLASS_LINEAR) {
+        unsigned log2 = 63 - (unsigned) __builtin_clzll((unsigned long long) (size - 1));
+        step = ((size_t) 1 << log2) / MEM_SIZE_CLASSES_PER_DOUBLING;
+    }
+    return (size + step - 1) & ~(step - 1);
+}
 
-    return (alloc_pt) node;
+static uint32_t _mem_find_gap(pool_mgr_pt pool_mgr, size_t size) {
+    uint32_t node = NODE_NIL;
+    // if FIRST_FIT, then find the lowest-addressed sufficient gap in the gap tree
+    if(pool_mgr->pool.policy == FIRST_FIT) {
+#ifndef MEM_FIRST_FIT_GAP_LIST
+        node = _mem_gap_tree_first_fit(pool_mgr, size);
+#else
+        node = _mem_gap_list_first_fit(pool_mgr, size);
+#endif
+    }
+    // if BEST_FIT, then find the first sufficient node in the gap index
+    // note: the index is sorted by size, then address, so this is the
+    //       lowest-addressed of the smallest sufficient gaps
+    else if(pool_mgr->pool.policy == BEST_FIT) {
+        unsigned i = _mem_search_gap_ix(pool_mgr, size, 0);
+        if(i < _mem_gap_ix_size(pool_mgr)) {
+            node = pool_mgr->gap_nodes[i];
+        }
+    }
+    return node;
 }
 
 alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
-    //printf("mem_del_alloc\n");
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt node = (node_pt) alloc;
-    // find the node in the node heap
-    int index = -1;/*
-    for(int i = 0; i < memPoolMgr->total_nodes; i++) {
-        if(node->alloc_record.mem == memPoolMgr->node_heap[i].alloc_record.mem) {
-            index = i;
-        }
-    }*/
-    node_pt currentNode = memPoolMgr->node_heap;
-    while(currentNode != NULL && currentNode->used == 1) {
-        if(node->alloc_record.mem == currentNode->alloc_record.mem) {
-            node = currentNode;
-            currentNode = NULL;
-            index = 0;
-        }
-        else {
-            currentNode = currentNode->next;
-        }
+    if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        return _mem_sharded_del_alloc(memPoolMgr, alloc);
     }
-    // this is node-to-delete
-    // make sure it's found
-    assert(index != -1);
-    // convert to gap node
-    node->allocated = 0;
-    // update metadata (num_allocs, alloc_size)
-    memPoolMgr->pool.num_allocs--;
-    memPoolMgr->pool.alloc_size -= node->alloc_record.size;
-    node_pt finalNode = node;
-    _mem_add_to_gap_ix(memPoolMgr, finalNode->alloc_record.size, finalNode);
-    if(node->next != NULL && node->next->used == 1 && node->next->allocated == 0) {
-        finalNode = mergeGaps(memPoolMgr, node, node->next);
+    // other threads don't touch the pool, they queue the record for the owner
+    if((memPoolMgr->flags & POOL_OWNER_THREAD) &&
+       !pthread_equal(pthread_self(), memPoolMgr->owner)) {
+        _mem_push_remote_free(memPoolMgr, alloc);
+        return ALLOC_OK;
     }
-    if(finalNode->prev != NULL && finalNode->prev->allocated == 0) {
-        finalNode = mergeGaps(memPoolMgr, finalNode->prev, finalNode);
+    // the maintenance thread, or other threads, work on the pool between calls
+    if(memPoolMgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_lock(&memPoolMgr->lock);
     }
-    // if the next node in the list is also a gap, merge into node-to-delete
-    //   remove the next node from gap index
-    //   check success
-    //   add the size to the node-to-delete
-    //   update node as unused
-    //   update metadata (used nodes)
-    //   update linked list:
-    /*
-                    if (next->next) {
-                        next->next->prev = node_to_del;
-                        node_to_del->next = next->next;
-                    } else {
-                        node_to_del->next = NULL;
-                    }
-                    next->next = NULL;
-                    next->prev = NULL;
-     */
-
-    // this merged node-to-delete might need to be added to the gap index
-    // but one more thing to check...
-    // if the previous node in the list is also a gap, merge into previous!
-    //   remove the previous node from gap index
-    //   check success
-    //   add the size of node-to-delete to the previous
-    //   update node-to-delete as unused
-    //   update metadata (used_nodes)
-    //   update linked list
-    /*
-                    if (node_to_del->next) {
-                        prev->next = node_to_del->next;
-                        node_to_del->next->prev = prev;
-                    } else {
-                        prev->next = NULL;
-                    }
-                    node_to_del->next = NULL;
-                    node_to_del->prev = NULL;
-     */
-    //   change the node to add to the previous node!
-    // add the resulting node to the gap index
-    // check success
-
-    return ALLOC_OK;
-}
-static node_pt mergeGaps(pool_mgr_pt poolManager, node_pt node, node_pt nextNode) {
-    assert(node->allocated == 0);
-    assert(nextNode->allocated == 0);
-    _mem_remove_from_gap_ix(poolManager, nextNode->alloc_record.size, nextNode);
-    _mem_remove_from_gap_ix(poolManager, node->alloc_record.size, node);
-    node->alloc_record.size += nextNode->alloc_record.size;
-    nextNode->alloc_record.size = 0;
-    nextNode->alloc_record.mem = NULL;
-    nextNode->used = 0;
-    poolManager->used_nodes--;
-    if(nextNode->next != NULL) {
-        node->next = nextNode->next;
-        nextNode->next->prev = node;
+    // other processes work on a shared pool between calls
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
     }
-    else {
-        node->next = NULL;
+    _mem_write_begin(memPoolMgr);
+    alloc_status status = _mem_del_alloc(memPoolMgr, alloc);
+    _mem_write_end(memPoolMgr);
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
     }
-    nextNode->next = NULL;
-    nextNode->prev = NULL;
-    _mem_add_to_gap_ix(poolManager, node->alloc_record.size, node);
-    return node;
+    if(memPoolMgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_unlock(&memPoolMgr->lock);
+    }
+    return status;
+}
+
+static alloc_status _mem_del_alloc(pool_mgr_pt memPoolMgr, alloc_pt alloc) {
+    if(memPoolMgr->flags & POOL_BOUNDARY_TAGS) {
+        return _mem_tag_del_alloc(memPoolMgr, alloc);
+    }
+    // find the node from the allocation record: records sit in aligned
+    // chunks that know the node index of their first record
+    alloc_chunk_pt chunk = (alloc_chunk_pt) ((uintptr_t) alloc & ~((uintptr_t) MEM_ALLOC_CHUNK_SIZE - 1));
+    if(chunk->pool_mgr != memPoolMgr) {
+        return ALLOC_FAIL;
+    }
+    uint32_t node = chunk->base + (uint32_t) (alloc - chunk->records);
+    node_pt heap = memPoolMgr->node_heap;
+    // this is node-to-delete
+    // make sure it's an allocation
+    if(node >= memPoolMgr->total_nodes || !_node_is_allocated(&heap[node])) {
+        return ALLOC_FAIL;
+    }
+    // convert to gap node
+    size_t size = _node_size(&heap[node]);
+    _mem_offset_ix_remove(memPoolMgr, node);
+    _node_set(&heap[node], size, 0);
+    _mem_gap_age_set(memPoolMgr, node, _mem_gap_age_now());
+    memPoolMgr->requested_size -= alloc->size;
+    alloc->mem = NULL;
+    alloc->size = 0;
+    // update metadata (num_allocs, alloc_size)
+    memPoolMgr->pool.num_allocs--;
+    memPoolMgr->pool.alloc_size -= size;
+    // deferred coalescing: the gap goes on the quick list of its size as
+    // it is, to be merged with its neighbors in a later batch
+    uint32_t *quick = NULL;
+    if(memPoolMgr->quick_bins != NULL) {
+        unsigned threshold = (memPoolMgr->flags & POOL_BACKGROUND)
+                             ? MEM_QUICK_MERGE_THRESHOLD * MEM_QUICK_BACKGROUND_FACTOR
+                             : MEM_QUICK_MERGE_THRESHOLD;
+        if(_mem_quick_push(memPoolMgr, node)) {
+            return (memPoolMgr->num_quick >= threshold) ? _mem_coalesce(memPoolMgr) : ALLOC_OK;
+        }
+        // all the bins hold other sizes: this gap is merged now, with the
+        // neighbors in the gap index (quick ones wait for the batch)
+        quick = memPoolMgr->quick_links;
+    }
+    // if the next node in the list is also a gap, merge into node-to-delete
+    uint32_t next = heap[node].next;
+    if(next != NODE_NIL && _node_is_gap(&heap[next]) && (quick == NULL || quick[next] == QUICK_NONE)) {
+        //   remove the next node from gap index
+        //   check success
+        if(_mem_remove_from_gap_ix(memPoolMgr, _node_size(&heap[next]), next) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        mergeGaps(memPoolMgr, node, next);
+    }
+    // if the previous node in the list is also a gap, merge into previous!
+    uint32_t prev = heap[node].prev;
+    if(prev != NODE_NIL && _node_is_gap(&heap[prev]) && (quick == NULL || quick[prev] == QUICK_NONE)) {
+        //   remove the previous node from gap index
+        //   check success
+        if(_mem_remove_from_gap_ix(memPoolMgr, _node_size(&heap[prev]), prev) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        //   change the node to add to the previous node!
+        node = mergeGaps(memPoolMgr, prev, node);
+    }
+    // add the resulting node to the gap index
+    // check success
+    return _mem_add_to_gap_ix(memPoolMgr, _node_size(&heap[node]), node);
+}
+
+#ifndef NDEBUG
+// whether a record freed by another thread is still an allocation of the
+// pool: not freed, and not queued already, which would link it into the
+// stack twice, and to itself; a live record's mem is its block's (read
+// racing with the owner, good enough to catch a double free)
+static int _mem_remote_free_is_live(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    if(pool_mgr->flags & POOL_BOUNDARY_TAGS) {
+        tag_hdr_pt hdr = (tag_hdr_pt) ((char *) alloc - offsetof(tag_hdr_t, alloc_record));
+        return (hdr->tag & TAG_ALLOCATED) && alloc->mem == (char *) (hdr + 1);
+    }
+    return alloc->mem >= pool_mgr->pool.mem && alloc->mem < pool_mgr->pool.mem + pool_mgr->pool.total_size;
+}
+#endif
+
+// POOL_OWNER_THREAD: a lock-free stack of records freed by other threads,
+// linked through their mem pointers (the record is the pool's again)
+static void _mem_push_remote_free(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    assert(_mem_remote_free_is_live(pool_mgr, alloc));
+    alloc_pt head = atomic_load_explicit(&pool_mgr->remote_frees, memory_order_relaxed);
+    do {
+        alloc->mem = (char *) head;
+    } while(!atomic_compare_exchange_weak_explicit(&pool_mgr->remote_frees, &head, alloc,
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+// the owner takes the whole stack at once and frees the records in it
+static void _mem_drain_remote_frees(pool_mgr_pt pool_mgr) {
+    if(atomic_load_explicit(&pool_mgr->remote_frees, memory_order_relaxed) == NULL) {
+        return;
+    }
+    alloc_pt alloc = atomic_exchange_explicit(&pool_mgr->remote_frees, NULL, memory_order_acquire);
+    _mem_write_begin(pool_mgr);
+    while(alloc != NULL) {
+        alloc_pt next = (alloc_pt) alloc->mem;
+        _mem_del_alloc(pool_mgr, alloc);
+        alloc = next;
+    }
+    _mem_write_end(pool_mgr);
+}
+
+// merge two adjacent gaps, neither of which is in the gap index
+static uint32_t mergeGaps(pool_mgr_pt poolManager, uint32_t node, uint32_t nextNode) {
+    node_pt heap = poolManager->node_heap;
+    assert(_node_is_gap(&heap[node]));
+    assert(_node_is_gap(&heap[nextNode]));
+    assert(heap[node].next == nextNode);
+    //   add the size to the node
+    _node_set(&heap[node], _node_size(&heap[node]) + _node_size(&heap[nextNode]), 0);
+    //   the purged pages of both stay purged, the gap starts over
+    if(poolManager->gap_ages != NULL) {
+        gap_age_pt ages = poolManager->gap_ages;
+        ages[node].purged += ages[nextNode].purged;
+        ages[node].since = _mem_gap_age_now();
+        ages[node].dirty = 1;
+        ages[nextNode].purged = 0;
+    }
+    //   update linked list
+    heap[node].next = heap[nextNode].next;
+    if(heap[nextNode].next != NODE_NIL) {
+        heap[heap[nextNode].next].prev = node;
+    }
+    //   update next node as unused
+    //   update metadata (used nodes)
+    _mem_put_unused_node(poolManager, nextNode);
+    poolManager->used_nodes--;
+    return node;
 }
 
 void mem_inspect_pool(pool_pt pool,
                       pool_segment_pt *segments,
                       unsigned *num_segments) {
-    //printf("mem_inspect_pool\n");
     // get the mgr from the pool
     pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
-    // allocate the segments array with size == used_nodes
-    // check successful
-    pool_segment_pt segmentArray = calloc(memPoolMgr->used_nodes, sizeof(pool_segment_t));
-    // loop through the node heap and the segments array
-    //    for each node, write the size and allocated in the segment
-    // "return" the values:
-    /*
-                    *segments = segs;
-                    *num_segments = pool_mgr->used_nodes;
-     */
-    node_pt node = memPoolMgr->node_heap;
-    int i = 0;
-    while(node != NULL && node->used == 1) {
-        segmentArray[i].allocated = node->allocated;
-        segmentArray[i].size = node->alloc_record.size;
-        node = node->next;
-        i++;
+    if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        _mem_sharded_inspect_pool(memPoolMgr, segments, num_segments);
+        return;
+    }
+    // the seqlock doesn't reach other processes, they are locked out
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        if(_mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+            *segments = NULL;
+            *num_segments = 0;
+            return;
+        }
+        _mem_inspect_pool(memPoolMgr, segments, num_segments);
+        _mem_shared_unlock(memPoolMgr);
+        return;
+    }
+    _mem_inspect_pool(memPoolMgr, segments, num_segments);
+}
+
+// the bytes asked for by the allocations of a pool: a boundary-tag pool
+// counts them in alloc_size, a sharded one adds up its shards
+static size_t _mem_requested_size(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->flags & MEM_POOL_SHARDED) {
+        size_t size = 0;
+        for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+            size += _mem_requested_size(pool_mgr->shards[i]);
+        }
+        return size;
+    }
+    if(pool_mgr->flags & POOL_BOUNDARY_TAGS) {
+        return MEM_READ_ONCE(pool_mgr->pool.alloc_size);
+    }
+    return MEM_READ_ONCE(pool_mgr->requested_size);
+}
+
+static void _mem_inspect_pool(pool_mgr_pt memPoolMgr,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments) {
+    // copy the segments under the seqlock, the pool may be changing; a
+    // pool with a lock is walked under it once writers have torn enough
+    // walks, one without is retried as long as a writer moves it
+    pool_segment_pt segmentArray = NULL;
+    unsigned capacity = 0;
+    for(unsigned attempt = 0; ; attempt++) {
+        int locked = attempt == MEM_INSPECT_RETRIES &&
+                     (memPoolMgr->flags & (MEM_POOL_LOCKING | MEM_POOL_SHARD));
+        if(locked) {
+            pthread_mutex_lock(&memPoolMgr->lock);
+        }
+        unsigned seq = _mem_read_begin(memPoolMgr);
+        // allocate the segments array with size == used_nodes
+        // check successful
+        unsigned count = MEM_READ_ONCE(memPoolMgr->used_nodes);
+        if(count > capacity) {
+            free(segmentArray);
+            capacity = count;
+            segmentArray = calloc(capacity, sizeof(pool_segment_t));
+            if(segmentArray == NULL) {
+                if(locked) {
+                    pthread_mutex_unlock(&memPoolMgr->lock);
+                }
+                break;
+            }
+        }
+        // walk the tags or the node list, for each segment write the
+        // size and allocated in the segment
+        unsigned n = (memPoolMgr->flags & POOL_BOUNDARY_TAGS)
+                     ? _mem_tag_read_segments(memPoolMgr, segmentArray, count)
+                     : _mem_node_read_segments(memPoolMgr, segmentArray, count);
+        int torn = _mem_read_retry(memPoolMgr, seq);
+        if(locked) {
+            pthread_mutex_unlock(&memPoolMgr->lock);
+        }
+        if(!torn && n == count) {
+            // "return" the values
+            *segments = segmentArray;
+            *num_segments = n;
+            return;
+        }
+        // a walk no writer tore that doesn't add up to the count is of
+        // a broken pool, which another walk won't mend
+        if(!torn || locked) {
+            break;
+        }
+    }
+    free(segmentArray);
+    *segments = NULL;
+    *num_segments = 0;
+}
+
+alloc_status mem_pool_stats(pool_pt pool, pool_t *stats) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    // a sharded pool adds up the snapshots of its shards
+    if(memPoolMgr->flags & MEM_POOL_SHARDED) {
+        *stats = memPoolMgr->pool;
+        stats->alloc_size = 0;
+        stats->num_allocs = 0;
+        stats->num_gaps = 0;
+        stats->purged_size = 0;
+        stats->resident_size = 0;
+        for(unsigned i = 0; i < memPoolMgr->num_shards; i++) {
+            pool_t shardStats;
+            mem_pool_stats((pool_pt) memPoolMgr->shards[i], &shardStats);
+            stats->alloc_size += shardStats.alloc_size;
+            stats->num_allocs += shardStats.num_allocs;
+            stats->num_gaps += shardStats.num_gaps;
+            stats->purged_size += shardStats.purged_size;
+            stats->resident_size += shardStats.resident_size;
+        }
+        return ALLOC_OK;
+    }
+    // the seqlock doesn't reach other processes, they are locked out
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    unsigned seq;
+    do {
+        seq = _mem_read_begin(memPoolMgr);
+        stats->mem = memPoolMgr->pool.mem;
+        stats->policy = memPoolMgr->pool.policy;
+        stats->total_size = memPoolMgr->pool.total_size;
+        stats->alloc_size = MEM_READ_ONCE(memPoolMgr->pool.alloc_size);
+        stats->num_allocs = MEM_READ_ONCE(memPoolMgr->pool.num_allocs);
+        stats->num_gaps = MEM_READ_ONCE(memPoolMgr->pool.num_gaps);
+        stats->purged_size = MEM_READ_ONCE(memPoolMgr->pool.purged_size);
+        stats->resident_size = MEM_READ_ONCE(memPoolMgr->pool.resident_size);
+    } while(_mem_read_retry(memPoolMgr, seq));
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
+    }
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_frag(pool_pt pool, pool_frag_t *frag) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    // the segments are a snapshot, the requested bytes are read apart,
+    // so the two only agree while the pool isn't changing
+    pool_segment_pt segments = NULL;
+    unsigned numSegments = 0;
+    mem_inspect_pool(pool, &segments, &numSegments);
+    if(segments == NULL) {
+        return ALLOC_FAIL;
+    }
+    memset(frag, 0, sizeof(pool_frag_t));
+    for(unsigned i = 0; i < numSegments; i++) {
+        if(segments[i].allocated) {
+            frag->alloc_size += segments[i].size;
+            continue;
+        }
+        frag->free_size += segments[i].size;
+        frag->num_gaps++;
+        if(segments[i].size > frag->largest_gap) {
+            frag->largest_gap = segments[i].size;
+        }
+        if(segments[i].size < MEM_FRAG_SMALL_GAP) {
+            frag->num_small_gaps++;
+        }
+    }
+    free(segments);
+    frag->requested_size = _mem_requested_size(memPoolMgr);
+    if(frag->requested_size > frag->alloc_size) {
+        frag->requested_size = frag->alloc_size;
+    }
+    if(frag->alloc_size > 0) {
+        frag->internal = (double) (frag->alloc_size - frag->requested_size) / (double) frag->alloc_size;
+    }
+    if(frag->free_size > 0) {
+        frag->external = 1.0 - (double) frag->largest_gap / (double) frag->free_size;
+    }
+    return ALLOC_OK;
+}
+
+int mem_pool_numa_node(pool_pt pool) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    return (memPoolMgr->flags & POOL_NUMA_NODE) ? memPoolMgr->numa_node : -1;
+}
+
+alloc_status mem_pool_sync(pool_pt pool) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    if(!(memPoolMgr->flags & MEM_POOL_FILE)) {
+        return ALLOC_FAIL;
+    }
+    // the header stays dirty, the pool is still open
+    if(msync(memPoolMgr->file, MEM_FILE_HDR_SIZE + memPoolMgr->pool.total_size, MS_SYNC) != 0) {
+        return ALLOC_FAIL;
+    }
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_root(pool_pt pool, alloc_pt alloc) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    if(!(memPoolMgr->flags & MEM_POOL_FILE)) {
+        return ALLOC_FAIL;
+    }
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    alloc_status status = _mem_file_set_root(memPoolMgr, alloc);
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
+    }
+    return status;
+}
+
+alloc_pt mem_pool_get_root(pool_pt pool) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    if(!(memPoolMgr->flags & MEM_POOL_FILE)) {
+        return NULL;
+    }
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return NULL;
+    }
+    alloc_pt root = _mem_file_get_root(memPoolMgr);
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
+    }
+    return root;
+}
+
+size_t mem_pool_offset(pool_pt pool, alloc_pt alloc) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    // a shared record knows its block
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        return ((shared_record_pt) alloc)->offset + sizeof(tag_hdr_t);
+    }
+    return (size_t) (alloc->mem - pool->mem);
+}
+
+alloc_pt mem_pool_alloc_at(pool_pt pool, size_t offset) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    // only a boundary-tag block has its record beside it
+    if(!(memPoolMgr->flags & POOL_BOUNDARY_TAGS)) {
+        return NULL;
+    }
+    // other processes may be changing the tags
+    if((memPoolMgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(memPoolMgr) != ALLOC_OK) {
+        return NULL;
+    }
+    alloc_pt alloc = _mem_tag_alloc_at(memPoolMgr, offset);
+    if(memPoolMgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(memPoolMgr);
+    }
+    return alloc;
+}
+
+pool_handle_t mem_pool_handle(pool_pt pool) {
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) pool;
+    mem_context_pt ctx = memPoolMgr->ctx;
+    if(ctx == NULL) {
+        return POOL_HANDLE_NONE;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    pool_handle_t handle = ((pool_handle_t) ctx->pool_store[memPoolMgr->slot].gen << 32) | memPoolMgr->slot;
+    pthread_mutex_unlock(&ctx->lock);
+    return handle;
+}
+
+pool_pt mem_pool_from_handle(pool_handle_t handle) {
+    return mem_pool_from_handle_in(&default_context, handle);
+}
+
+pool_pt mem_pool_from_handle_in(mem_context_pt ctx, pool_handle_t handle) {
+    unsigned slot = (unsigned) (handle & UINT32_MAX);
+    unsigned gen = (unsigned) (handle >> 32);
+    pool_pt pool = NULL;
+    // a closed pool's slot has moved on to another generation
+    pthread_mutex_lock(&ctx->lock);
+    if(ctx->pool_store != NULL && slot < ctx->pool_store_size && ctx->pool_store[slot].gen == gen) {
+        pool = (pool_pt) ctx->pool_store[slot].mgr;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return pool;
+}
+
+void *mem_alloc(pool_pt pool, size_t size) {
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    return (alloc != NULL) ? alloc->mem : NULL;
+}
+
+alloc_status mem_release(pool_pt pool, void *ptr) {
+    return _mem_ptr_block((pool_mgr_pt) pool, ptr, 0, NULL);
+}
+
+alloc_status mem_release_sized(pool_pt pool, void *ptr, size_t size) {
+    // the size is checked against the block, not trusted; no block is of 0
+    if(size == 0) {
+        return ALLOC_FAIL;
+    }
+    return _mem_ptr_block((pool_mgr_pt) pool, ptr, size, NULL);
+}
+
+alloc_status mem_free_ptr(void *ptr) {
+    // find the pool by the address ranges of the open pools
+    pool_mgr_pt memPoolMgr = _mem_range_find((const char *) ptr);
+    if(memPoolMgr == NULL) {
+        return ALLOC_FAIL;
+    }
+    return _mem_ptr_block(memPoolMgr, ptr, 0, NULL);
+}
+
+size_t mem_ptr_size(void *ptr) {
+    size_t size = 0;
+    pool_mgr_pt memPoolMgr = _mem_range_find((const char *) ptr);
+    if(memPoolMgr == NULL || _mem_ptr_block(memPoolMgr, ptr, 0, &size) != ALLOC_OK) {
+        return 0;
+    }
+    return size;
+}
+
+alloc_status mem_maintenance_start(const maint_opts_t *opts) {
+    pthread_mutex_lock(&maint_lock);
+    if(default_context.pool_store == NULL || maint_running) {
+        pthread_mutex_unlock(&maint_lock);
+        return ALLOC_CALLED_AGAIN;
+    }
+    maint_opts.interval_ms = (opts != NULL && opts->interval_ms != 0) ? opts->interval_ms
+                                                                      : MEM_MAINT_INTERVAL_MS;
+    maint_opts.budget = (opts != NULL && opts->budget != 0) ? opts->budget : MEM_MAINT_BUDGET;
+    maint_opts.decay_ms = (opts != NULL && opts->decay_ms != 0) ? opts->decay_ms : MEM_MAINT_DECAY_MS;
+    maint_opts.lazy = (opts != NULL) ? opts->lazy : 0;
+    maint_stop = 0;
+    maint_woken = 0;
+    if(pthread_create(&maint_thread, NULL, _mem_maint_main, NULL) != 0) {
+        pthread_mutex_unlock(&maint_lock);
+        return ALLOC_FAIL;
+    }
+    maint_running = 1;
+    pthread_mutex_unlock(&maint_lock);
+    return ALLOC_OK;
+}
+
+alloc_status mem_maintenance_wake() {
+    pthread_mutex_lock(&maint_lock);
+    if(!maint_running) {
+        pthread_mutex_unlock(&maint_lock);
+        return ALLOC_FAIL;
+    }
+    maint_woken = 1;
+    pthread_cond_signal(&maint_cond);
+    pthread_mutex_unlock(&maint_lock);
+    return ALLOC_OK;
+}
+
+alloc_status mem_maintenance_stop() {
+    pthread_mutex_lock(&maint_lock);
+    if(!maint_running) {
+        pthread_mutex_unlock(&maint_lock);
+        return ALLOC_CALLED_AGAIN;
+    }
+    maint_stop = 1;
+    pthread_cond_signal(&maint_cond);
+    pthread_mutex_unlock(&maint_lock);
+    pthread_join(maint_thread, NULL);
+    pthread_mutex_lock(&maint_lock);
+    maint_running = 0;
+    pthread_mutex_unlock(&maint_lock);
+    return ALLOC_OK;
+}
+
+void mem_fork_prepare() {
+    // in the library's lock order, so no call is left holding one
+    pthread_mutex_lock(&maint_lock);
+    pthread_mutex_lock(&contexts_lock);
+    for(mem_context_pt ctx = contexts; ctx != NULL; ctx = ctx->next) {
+        pthread_mutex_lock(&ctx->lock);
+        _mem_fork_lock_pools(ctx, 1);
+    }
+    pthread_rwlock_wrlock(&pool_ranges_lock);
+}
+
+void mem_fork_parent() {
+    pthread_rwlock_unlock(&pool_ranges_lock);
+    _mem_fork_release();
+}
+
+void mem_fork_child() {
+    // the maintenance thread isn't forked, start it again to have one
+    maint_running = 0;
+    maint_stop = 0;
+    maint_woken = 0;
+    pthread_cond_init(&maint_cond, NULL);
+    // the write lock is held by the id the forking thread had
+    pthread_rwlock_init(&pool_ranges_lock, NULL);
+    _mem_fork_release();
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// allocate the pool store with initial capacity
+// note: holds pointers only, other functions to allocate/deallocate
+static alloc_status _mem_context_init(mem_context_pt ctx) {
+    ctx->pool_store = (pool_slot_pt) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_slot_t));
+    if(ctx->pool_store == NULL) {
+        return ALLOC_FAIL;
+    }
+    ctx->pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+    ctx->pool_store_size = 0;
+    ctx->pool_store_free = POOL_SLOT_NIL;
+    ctx->maint_cursor = 0;
+    return ALLOC_OK;
+}
+
+// close the pools of the context and free its pool store; a pool that
+// can't be closed is freed anyway, except in the default context, whose
+// pools are left as mem_free() always has
+static void _mem_context_close(mem_context_pt ctx) {
+    for(unsigned i = 0; i < ctx->pool_store_size; i++) {
+        pool_mgr_pt pool_mgr = ctx->pool_store[i].mgr;
+        if(pool_mgr == NULL || mem_pool_close((pool_pt) pool_mgr) == ALLOC_OK) {
+            continue;
+        }
+        pthread_mutex_lock(&ctx->lock);
+        _mem_pool_store_remove(pool_mgr);
+        pthread_mutex_unlock(&ctx->lock);
+        // mem_free() leaves the pools it can't close open, on their own:
+        // out of the store and the address ranges, to be closed later
+        if(ctx == &default_context) {
+            pool_mgr->ctx = NULL;
+            continue;
+        }
+        if(pool_mgr->flags & MEM_POOL_SHARDED) {
+            _mem_sharded_close(pool_mgr);
+        }
+        else {
+            _mem_free_pool_mgr(pool_mgr);
+        }
+    }
+    // can free the pool store array
+    free(ctx->pool_store);
+    ctx->pool_store = NULL;
+    ctx->pool_store_capacity = 0;
+    ctx->pool_store_size = 0;
+    ctx->pool_store_free = POOL_SLOT_NIL;
+}
+
+static alloc_status _mem_resize_pool_store(mem_context_pt ctx) {
+    // check if necessary
+    if(((float) ctx->pool_store_size / ctx->pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
+        pool_slot_pt newStore = (pool_slot_pt) realloc(ctx->pool_store,
+                sizeof(pool_slot_t) * ctx->pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR);
+        if(newStore == NULL) {
+            return ALLOC_FAIL;
+        }
+        // the new slots start at generation 0
+        memset(newStore + ctx->pool_store_capacity, 0,
+               sizeof(pool_slot_t) * ctx->pool_store_capacity * (MEM_POOL_STORE_EXPAND_FACTOR - 1));
+        // don't forget to update capacity variables
+        ctx->pool_store = newStore;
+        ctx->pool_store_capacity *= MEM_POOL_STORE_EXPAND_FACTOR;
+    }
+    return ALLOC_OK;
+}
+
+// link pool mgr to pool store, in a free slot or a new one
+static alloc_status _mem_pool_store_add(mem_context_pt ctx, pool_mgr_pt pool_mgr) {
+    pthread_mutex_lock(&ctx->lock);
+    // the pool can be found by address too
+    if(_mem_range_add(pool_mgr) != ALLOC_OK) {
+        pthread_mutex_unlock(&ctx->lock);
+        return ALLOC_FAIL;
+    }
+    unsigned slot = ctx->pool_store_free;
+    if(slot != POOL_SLOT_NIL) {
+        ctx->pool_store_free = ctx->pool_store[slot].next_free;
+    }
+    else {
+        // expand the pool store, if necessary
+        if(_mem_resize_pool_store(ctx) != ALLOC_OK) {
+            _mem_range_remove(pool_mgr);
+            pthread_mutex_unlock(&ctx->lock);
+            return ALLOC_FAIL;
+        }
+        slot = ctx->pool_store_size++;
+    }
+    ctx->pool_store[slot].mgr = pool_mgr;
+    ctx->pool_store[slot].gen++;
+    pool_mgr->ctx = ctx;
+    pool_mgr->slot = slot;
+    pthread_mutex_unlock(&ctx->lock);
+    return ALLOC_OK;
+}
+
+// note: called with the context's lock held
+static void _mem_pool_store_remove(pool_mgr_pt pool_mgr) {
+    mem_context_pt ctx = pool_mgr->ctx;
+    pool_slot_pt slot = &ctx->pool_store[pool_mgr->slot];
+    _mem_range_remove(pool_mgr);
+    // a new generation, the handles of the pool go stale
+    slot->mgr = NULL;
+    slot->gen++;
+    slot->next_free = ctx->pool_store_free;
+    ctx->pool_store_free = pool_mgr->slot;
+}
+
+static pool_mgr_pt _mem_pool_create(size_t size, alloc_policy policy, unsigned flags,
+                                    int numa_node, char *mem) {
+    // segment offsets and sizes must fit in the node
+    if(!(flags & POOL_BOUNDARY_TAGS) && size > MEM_POOL_MAX_SIZE) {
+        return NULL;
+    }
+    // and the gap links in the tags of a boundary-tag pool
+    if((flags & POOL_BOUNDARY_TAGS) && size > TAG_MAX_SIZE) {
+        return NULL;
+    }
+    // allocate a new mem pool mgr
+    pool_mgr_pt memPoolMgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    // check success, on error return null
+    if(memPoolMgr == NULL) {
+        return NULL;
+    }
+    memPoolMgr->flags = flags;
+    memPoolMgr->granularity = 1;
+    memPoolMgr->owner = pthread_self();
+    atomic_init(&memPoolMgr->remote_frees, NULL);
+    atomic_init(&memPoolMgr->seq, 0);
+    pthread_mutex_init(&memPoolMgr->lock, NULL);
+    memPoolMgr->pool.total_size = size;
+    memPoolMgr->pool.resident_size = size;
+    memPoolMgr->pool.policy = policy;
+    // allocate a new memory pool, unless it is a shard of a larger one;
+    // a NUMA pool is mapped and bound to its node before it is touched,
+    // a reserved one is mapped without access, and committed as needed
+    memPoolMgr->numa_node = numa_node;
+    if(mem != NULL) {
+        memPoolMgr->pool.mem = mem;
+    }
+    else if(flags & (POOL_NUMA_NODE | POOL_RESERVE)) {
+        int prot = (flags & POOL_RESERVE) ? PROT_NONE : PROT_READ | PROT_WRITE;
+        void *map = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        memPoolMgr->pool.mem = (map != MAP_FAILED) ? (char*) map : NULL;
+        if(memPoolMgr->pool.mem != NULL && (flags & POOL_NUMA_NODE)) {
+            _mem_numa_bind(memPoolMgr->pool.mem, size, &memPoolMgr->numa_node);
+        }
+        if(flags & POOL_RESERVE) {
+            memPoolMgr->pool.resident_size = 0;
+        }
+    }
+    else {
+        memPoolMgr->pool.mem = (char*) malloc(size);
+    }
+    // boundary-tag pools keep all their metadata in the pool itself;
+    // a file-backed pool is formatted or recovered by the caller
+    if(flags & POOL_BOUNDARY_TAGS) {
+        if(memPoolMgr->pool.mem == NULL ||
+           ((flags & POOL_RESERVE) && _mem_commit(memPoolMgr, sizeof(tag_hdr_t)) != ALLOC_OK) ||
+           (!(flags & MEM_POOL_FILE) && _mem_tag_init(memPoolMgr) != ALLOC_OK)) {
+            _mem_free_pool_mgr(memPoolMgr);
+            return NULL;
+        }
+        return memPoolMgr;
+    }
+    // allocate a new node heap
+    memPoolMgr->node_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
+    // allocate a new gap index: a sorted array for BEST_FIT, the links
+    // of a tree for FIRST_FIT
+    if(policy == BEST_FIT) {
+        memPoolMgr->gap_sizes = (mem_off_t*) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(mem_off_t));
+        memPoolMgr->gap_nodes = (uint32_t*) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(uint32_t));
+    }
+    else {
+        memPoolMgr->gap_links = (gap_link_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(gap_link_t));
+    }
+    // deferred coalescing: the quick bins, and links beside the node heap
+    if(flags & POOL_DEFERRED_COALESCING) {
+        memPoolMgr->quick_bins = (quick_bin_pt) calloc(MEM_QUICK_BINS, sizeof(quick_bin_t));
+        memPoolMgr->quick_links = (uint32_t*) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(uint32_t));
+        if(memPoolMgr->quick_bins == NULL || memPoolMgr->quick_links == NULL) {
+            _mem_free_pool_mgr(memPoolMgr);
+            return NULL;
+        }
+        for(unsigned i = 0; i < MEM_QUICK_BINS; i++) {
+            memPoolMgr->quick_bins[i].size = QUICK_EMPTY;
+            memPoolMgr->quick_bins[i].head = NODE_NIL;
+        }
+        for(unsigned i = 0; i < MEM_NODE_HEAP_INIT_CAPACITY; i++) {
+            memPoolMgr->quick_links[i] = QUICK_NONE;
+        }
+    }
+    // background: the ages of the gaps, for the purge
+    if(flags & POOL_BACKGROUND) {
+        memPoolMgr->gap_ages = (gap_age_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(gap_age_t));
+        if(memPoolMgr->gap_ages == NULL) {
+            _mem_free_pool_mgr(memPoolMgr);
+            return NULL;
+        }
+    }
+    // allocate the (empty) table of allocation record chunks
+    memPoolMgr->num_alloc_chunks =
+            (MEM_NODE_HEAP_INIT_CAPACITY + MEM_ALLOC_CHUNK_RECORDS - 1) / MEM_ALLOC_CHUNK_RECORDS;
+    memPoolMgr->alloc_chunks = (alloc_chunk_pt*) calloc(memPoolMgr->num_alloc_chunks, sizeof(alloc_chunk_pt));
+    // check success, on error deallocate everything and return null
+    if(memPoolMgr->pool.mem == NULL || memPoolMgr->node_heap == NULL ||
+       (memPoolMgr->gap_nodes == NULL && memPoolMgr->gap_links == NULL) ||
+       (policy == BEST_FIT && memPoolMgr->gap_sizes == NULL) ||
+       memPoolMgr->alloc_chunks == NULL) {
+        _mem_free_pool_mgr(memPoolMgr);
+        return NULL;
+    }
+    memPoolMgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    memPoolMgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    // assign all the pointers and update meta data:
+    //   chain the unused nodes (all but the top one) into the free stack
+    memPoolMgr->free_node = NODE_NIL;
+    for(uint32_t i = memPoolMgr->total_nodes - 1; i > 0; i--) {
+        _mem_put_unused_node(memPoolMgr, i);
+    }
+    //   initialize top node of node heap
+    memPoolMgr->node_heap[0].offset = 0;
+    _node_set(&memPoolMgr->node_heap[0], size, 0);
+    memPoolMgr->node_heap[0].next = NODE_NIL;
+    memPoolMgr->node_heap[0].prev = NODE_NIL;
+    _mem_gap_age_set(memPoolMgr, 0, _mem_gap_age_now());
+    //   initialize top node of gap index
+    if(memPoolMgr->gap_nodes != NULL) {
+        memPoolMgr->gap_nodes[0] = 0;
+        memPoolMgr->gap_sizes[0] = (mem_off_t) size;
+    }
+    else {
+#ifndef MEM_FIRST_FIT_GAP_LIST
+        memPoolMgr->gap_links[0].left = NODE_NIL;
+        memPoolMgr->gap_links[0].right = NODE_NIL;
+        memPoolMgr->gap_links[0].max = (mem_off_t) size;
+#else
+        memPoolMgr->gap_links[0].next = NODE_NIL;
+        memPoolMgr->gap_links[0].prev = NODE_NIL;
+#endif
+        memPoolMgr->gap_root = 0;
+        memPoolMgr->gap_hint = NODE_NIL;
+    }
+    //   initialize pool mgr
+    memPoolMgr->used_nodes = 1;
+    memPoolMgr->pool.alloc_size = 0;
+    memPoolMgr->pool.num_allocs = 0;
+    memPoolMgr->pool.num_gaps = 1;
+    return memPoolMgr;
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
+    // see above
+    if(((float) pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
+        // on the pool's node, if it has one
+        numa_policy_t saved;
+        _mem_numa_enter(pool_mgr->numa_node, &saved);
+        alloc_status status = _mem_grow_node_heap(pool_mgr);
+        _mem_numa_leave(&saved);
+        return status;
+    }
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_grow_node_heap(pool_mgr_pt pool_mgr) {
+    unsigned newTotal = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
+    // nodes refer to each other by index, so the heap can move;
+    // readers may still be walking the old one, so it is retired
+    // until the pool closes (linked through its first bytes)
+    node_pt newHeap = malloc(sizeof(node_t) * newTotal);
+    if(newHeap == NULL) {
+        return ALLOC_FAIL;
+    }
+    memcpy(newHeap, pool_mgr->node_heap, sizeof(node_t) * pool_mgr->total_nodes);
+    memcpy(pool_mgr->node_heap, &pool_mgr->retired_heaps, sizeof(node_pt));
+    pool_mgr->retired_heaps = pool_mgr->node_heap;
+    pool_mgr->node_heap = newHeap;
+    // the gap tree links grow with the heap
+    if(pool_mgr->gap_links != NULL) {
+        gap_link_pt newLinks = realloc(pool_mgr->gap_links, sizeof(gap_link_t) * newTotal);
+        if(newLinks == NULL) {
+            return ALLOC_FAIL;
+        }
+        pool_mgr->gap_links = newLinks;
+    }
+    // so do the quick links
+    if(pool_mgr->quick_links != NULL) {
+        uint32_t *newQuick = realloc(pool_mgr->quick_links, sizeof(uint32_t) * newTotal);
+        if(newQuick == NULL) {
+            return ALLOC_FAIL;
+        }
+        for(unsigned i = pool_mgr->total_nodes; i < newTotal; i++) {
+            newQuick[i] = QUICK_NONE;
+        }
+        pool_mgr->quick_links = newQuick;
+    }
+    // and the gap ages
+    if(pool_mgr->gap_ages != NULL) {
+        gap_age_pt newAges = realloc(pool_mgr->gap_ages, sizeof(gap_age_t) * newTotal);
+        if(newAges == NULL) {
+            return ALLOC_FAIL;
+        }
+        memset(newAges + pool_mgr->total_nodes, 0, sizeof(gap_age_t) * (newTotal - pool_mgr->total_nodes));
+        pool_mgr->gap_ages = newAges;
+    }
+    // the chunk table grows with the heap, the chunks themselves don't move
+    unsigned newChunks = (newTotal + MEM_ALLOC_CHUNK_RECORDS - 1) / MEM_ALLOC_CHUNK_RECORDS;
+    if(newChunks > pool_mgr->num_alloc_chunks) {
+        alloc_chunk_pt *newTable = realloc(pool_mgr->alloc_chunks, sizeof(alloc_chunk_pt) * newChunks);
+        if(newTable == NULL) {
+            return ALLOC_FAIL;
+        }
+        for(unsigned i = pool_mgr->num_alloc_chunks; i < newChunks; i++) {
+            newTable[i] = NULL;
+        }
+        pool_mgr->alloc_chunks = newTable;
+        pool_mgr->num_alloc_chunks = newChunks;
+    }
+    // push the new nodes on the unused stack, lowest index on top
+    for(uint32_t i = newTotal - 1; i >= pool_mgr->total_nodes; i--) {
+        _mem_put_unused_node(pool_mgr, i);
+    }
+    // readers see the new heap before its new size
+    atomic_thread_fence(memory_order_release);
+    pool_mgr->total_nodes = newTotal;
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
+    // see above
+    if(((float) _mem_gap_ix_size(pool_mgr) / pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR) {
+        // on the pool's node, if it has one
+        numa_policy_t saved;
+        _mem_numa_enter(pool_mgr->numa_node, &saved);
+        alloc_status status = _mem_grow_gap_ix(pool_mgr);
+        _mem_numa_leave(&saved);
+        return status;
+    }
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_grow_gap_ix(pool_mgr_pt pool_mgr) {
+    unsigned newCapacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+    mem_off_t *newSizes = realloc(pool_mgr->gap_sizes, sizeof(mem_off_t) * newCapacity);
+    if(newSizes == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->gap_sizes = newSizes;
+    uint32_t *newNodes = realloc(pool_mgr->gap_nodes, sizeof(uint32_t) * newCapacity);
+    if(newNodes == NULL) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->gap_nodes = newNodes;
+    pool_mgr->gap_ix_capacity = newCapacity;
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       uint32_t node) {
+    // FIRST_FIT: insert into the gap tree (list)
+    if(pool_mgr->gap_links != NULL) {
+#ifndef MEM_FIRST_FIT_GAP_LIST
+        pool_mgr->gap_root = _mem_gap_tree_insert(pool_mgr, pool_mgr->gap_root, node);
+#else
+        _mem_gap_list_insert(pool_mgr, node);
+#endif
+        pool_mgr->pool.num_gaps++;
+        return ALLOC_OK;
+    }
+    // expand the gap index, if necessary (call the function)
+    if(_mem_resize_gap_ix(pool_mgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    // find the position that keeps the index sorted
+    unsigned i = _mem_search_gap_ix(pool_mgr, size, pool_mgr->node_heap[node].offset);
+    // move the entries from there on one position down, and insert
+    unsigned tail = _mem_gap_ix_size(pool_mgr) - i;
+    memmove(&pool_mgr->gap_sizes[i + 1], &pool_mgr->gap_sizes[i], tail * sizeof(mem_off_t));
+    memmove(&pool_mgr->gap_nodes[i + 1], &pool_mgr->gap_nodes[i], tail * sizeof(uint32_t));
+    pool_mgr->gap_sizes[i] = (mem_off_t) size;
+    pool_mgr->gap_nodes[i] = node;
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps++;
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
+                                            size_t size,
+                                            uint32_t node) {
+    // FIRST_FIT: remove from the gap tree (list)
+    if(pool_mgr->gap_links != NULL) {
+        assert(_node_size(&pool_mgr->node_heap[node]) == size);
+#ifndef MEM_FIRST_FIT_GAP_LIST
+        pool_mgr->gap_root = _mem_gap_tree_remove(pool_mgr, pool_mgr->gap_root, node);
+#else
+        _mem_gap_list_remove(pool_mgr, node);
+#endif
+        pool_mgr->pool.num_gaps--;
+        return ALLOC_OK;
+    }
+    // find the position of the node in the gap index
+    unsigned i = _mem_search_gap_ix(pool_mgr, size, pool_mgr->node_heap[node].offset);
+    if(i == _mem_gap_ix_size(pool_mgr) || pool_mgr->gap_nodes[i] != node) {
+        return ALLOC_FAIL;
+    }
+    // pull the entries that follow one position up
+    // this effectively deletes the chosen node
+    unsigned tail = _mem_gap_ix_size(pool_mgr) - i - 1;
+    memmove(&pool_mgr->gap_sizes[i], &pool_mgr->gap_sizes[i + 1], tail * sizeof(mem_off_t));
+    memmove(&pool_mgr->gap_nodes[i], &pool_mgr->gap_nodes[i + 1], tail * sizeof(uint32_t));
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps--;
+    return ALLOC_OK;
+}
+
+// binary search of the gap index, sorted by size, then address: the
+// position of the first entry not below (size, offset)
+// note: the sizes are scanned without touching the node heap, which is
+//       only needed to order gaps of equal size
+static unsigned _mem_search_gap_ix(pool_mgr_pt pool_mgr, size_t size, mem_off_t offset) {
+    const mem_off_t *sizes = pool_mgr->gap_sizes;
+    unsigned lo = 0;
+    unsigned hi = _mem_gap_ix_size(pool_mgr);
+    while(lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if(sizes[mid] < size ||
+           (sizes[mid] == size && pool_mgr->node_heap[pool_mgr->gap_nodes[mid]].offset < offset)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static uint32_t _mem_get_unused_node(pool_mgr_pt pool_mgr) {
+    uint32_t node = pool_mgr->free_node;
+    if(node != NODE_NIL) {
+        pool_mgr->free_node = pool_mgr->node_heap[node].next;
+    }
+    return node;
+}
+
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, uint32_t node) {
+    pool_mgr->node_heap[node].offset = 0;
+    pool_mgr->node_heap[node].size = 0;
+    pool_mgr->node_heap[node].prev = NODE_NIL;
+    pool_mgr->node_heap[node].next = pool_mgr->free_node;
+    pool_mgr->free_node = node;
+}
+
+static alloc_pt _mem_get_alloc_record(pool_mgr_pt pool_mgr, uint32_t node) {
+    unsigned c = node / MEM_ALLOC_CHUNK_RECORDS;
+    assert(c < pool_mgr->num_alloc_chunks);
+    // allocate the chunk on first use
+    if(pool_mgr->alloc_chunks[c] == NULL) {
+        numa_policy_t saved;
+        _mem_numa_enter(pool_mgr->numa_node, &saved);
+        alloc_chunk_pt chunk = aligned_alloc(MEM_ALLOC_CHUNK_SIZE, MEM_ALLOC_CHUNK_SIZE);
+        _mem_numa_leave(&saved);
+        if(chunk == NULL) {
+            return NULL;
+        }
+        chunk->pool_mgr = pool_mgr;
+        chunk->base = c * MEM_ALLOC_CHUNK_RECORDS;
+        pool_mgr->alloc_chunks[c] = chunk;
+    }
+    return &pool_mgr->alloc_chunks[c]->records[node % MEM_ALLOC_CHUNK_RECORDS];
+}
+
+// seqlock reader: the segments in list order, or capacity + 1 when the
+// list was changing under the walk (the caller retries)
+static unsigned _mem_node_read_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                        unsigned capacity) {
+    // the heap holds at least as many nodes as were read
+    unsigned total = MEM_READ_ONCE(pool_mgr->total_nodes);
+    atomic_thread_fence(memory_order_acquire);
+    node_pt heap = MEM_READ_ONCE(pool_mgr->node_heap);
+    unsigned i = 0;
+    for(uint32_t node = 0; node != NODE_NIL; node = MEM_READ_ONCE(heap[node].next)) {
+        if(node >= total || i == capacity) {
+            return capacity + 1;
+        }
+        mem_off_t size = MEM_READ_ONCE(heap[node].size);
+        segments[i].allocated = (size & NODE_ALLOCATED) ? 1 : 0;
+        segments[i].size = size & NODE_SIZE_MASK;
+        i++;
+    }
+    return i;
+}
+
+static void _mem_free_pool_mgr(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->alloc_chunks != NULL) {
+        for(unsigned i = 0; i < pool_mgr->num_alloc_chunks; i++) {
+            free(pool_mgr->alloc_chunks[i]);
+        }
+    }
+    free(pool_mgr->alloc_chunks);
+    free(pool_mgr->gap_sizes);
+    free(pool_mgr->gap_nodes);
+    free(pool_mgr->gap_links);
+    free(pool_mgr->quick_bins);
+    free(pool_mgr->quick_links);
+    free(pool_mgr->gap_ages);
+    free(pool_mgr->offset_ix);
+    _mem_shared_records_free(pool_mgr);
+    free(pool_mgr->node_heap);
+    while(pool_mgr->retired_heaps != NULL) {
+        node_pt heap = pool_mgr->retired_heaps;
+        memcpy(&pool_mgr->retired_heaps, heap, sizeof(node_pt));
+        free(heap);
+    }
+    if(pool_mgr->flags & MEM_POOL_FILE) {
+        munmap(pool_mgr->pool.mem - MEM_FILE_HDR_SIZE, MEM_FILE_HDR_SIZE + pool_mgr->pool.total_size);
+    }
+    else if(pool_mgr->flags & MEM_POOL_SHARD) {
+        // the memory is the parent's
+    }
+    else if(pool_mgr->flags & (POOL_NUMA_NODE | POOL_RESERVE)) {
+        if(pool_mgr->pool.mem != NULL) {
+            munmap(pool_mgr->pool.mem, pool_mgr->pool.total_size);
+        }
+    }
+    else {
+        free(pool_mgr->pool.mem);
+    }
+    pthread_mutex_destroy(&pool_mgr->lock);
+    free(pool_mgr);
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* Deferred coalescing                   */
+/*                                       */
+/*****************************************/
+// POOL_DEFERRED_COALESCING: a freed block stays as it is, a gap that is
+// neither merged nor in the gap index, on the quick list of its exact
+// size; the bins are an open-addressed table of sizes in which a size
+// keeps its bin until the next merge empties them all
+
+static inline unsigned _quick_bin(size_t size) {
+    uint32_t h = (uint32_t) size * 0x9E3779B1u;
+    return (h >> 16) & (MEM_QUICK_BINS - 1);
+}
+
+// put a gap on the quick list of its size; 0 if all the bins are taken
+// by other sizes (the gap is left as it was, for the caller to merge)
+static int _mem_quick_push(pool_mgr_pt pool_mgr, uint32_t node) {
+    mem_off_t size = (mem_off_t) _node_size(&pool_mgr->node_heap[node]);
+    for(unsigned i = 0, bin = _quick_bin(size); i < MEM_QUICK_BINS; i++, bin = (bin + 1) & (MEM_QUICK_BINS - 1)) {
+        quick_bin_pt quick = &pool_mgr->quick_bins[bin];
+        if(quick->size == QUICK_EMPTY) {
+            quick->size = size;
+        }
+        if(quick->size == size) {
+            pool_mgr->quick_links[node] = quick->head;
+            quick->head = node;
+            pool_mgr->num_quick++;
+            pool_mgr->pool.num_gaps++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// take a gap of exactly this size off its quick list, NODE_NIL if none
+static uint32_t _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size) {
+    for(unsigned i = 0, bin = _quick_bin(size); i < MEM_QUICK_BINS; i++, bin = (bin + 1) & (MEM_QUICK_BINS - 1)) {
+        quick_bin_pt quick = &pool_mgr->quick_bins[bin];
+        if(quick->size == QUICK_EMPTY) {
+            break;
+        }
+        if(quick->size == size) {
+            uint32_t node = quick->head;
+            if(node != NODE_NIL) {
+                quick->head = pool_mgr->quick_links[node];
+                pool_mgr->quick_links[node] = QUICK_NONE;
+                pool_mgr->num_quick--;
+                pool_mgr->pool.num_gaps--;
+            }
+            return node;
+        }
+    }
+    return NODE_NIL;
+}
+
+// the batch merge: one pass over the node list, merging every run of
+// adjacent gaps that holds a quick one into a single indexed gap
+static alloc_status _mem_coalesce(pool_mgr_pt pool_mgr) {
+    node_pt heap = pool_mgr->node_heap;
+    uint32_t *quick = pool_mgr->quick_links;
+    for(uint32_t node = 0; node != NODE_NIL; node = heap[node].next) {
+        if(!_node_is_gap(&heap[node])) {
+            continue;
+        }
+        uint32_t next = heap[node].next;
+        int nextIsGap = (next != NODE_NIL && _node_is_gap(&heap[next]));
+        // a lone indexed gap stays as it is
+        if(quick[node] == QUICK_NONE && !nextIsGap) {
+            continue;
+        }
+        // take the first gap of the run out of the gap index (or off
+        // its quick list: the lists are all emptied below)
+        if(quick[node] != QUICK_NONE) {
+            quick[node] = QUICK_NONE;
+            pool_mgr->num_quick--;
+            pool_mgr->pool.num_gaps--;
+        }
+        else if(_mem_remove_from_gap_ix(pool_mgr, _node_size(&heap[node]), node) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+        // merge the rest of the run into it
+        while(nextIsGap) {
+            if(quick[next] != QUICK_NONE) {
+                quick[next] = QUICK_NONE;
+                pool_mgr->num_quick--;
+                pool_mgr->pool.num_gaps--;
+            }
+            else if(_mem_remove_from_gap_ix(pool_mgr, _node_size(&heap[next]), next) != ALLOC_OK) {
+                return ALLOC_FAIL;
+            }
+            mergeGaps(pool_mgr, node, next);
+            next = heap[node].next;
+            nextIsGap = (next != NODE_NIL && _node_is_gap(&heap[next]));
+        }
+        if(_mem_add_to_gap_ix(pool_mgr, _node_size(&heap[node]), node) != ALLOC_OK) {
+            return ALLOC_FAIL;
+        }
+    }
+    // all the quick lists are empty now, free the bins for other sizes
+    assert(pool_mgr->num_quick == 0);
+    for(unsigned i = 0; i < MEM_QUICK_BINS; i++) {
+        pool_mgr->quick_bins[i].size = QUICK_EMPTY;
+        pool_mgr->quick_bins[i].head = NODE_NIL;
+    }
+    return ALLOC_OK;
+}
+
+
+
+#ifndef MEM_FIRST_FIT_GAP_LIST
+/*****************************************/
+/*                                       */
+/* Gap tree (FIRST_FIT)                  */
+/*                                       */
+/*****************************************/
+// a treap keyed by segment offset, with priorities hashed from the node
+// index; every gap holds the largest gap size in its subtree, so the
+// search can skip subtrees in which nothing fits
+
+static inline uint32_t _gap_tree_priority(uint32_t node) {
+    uint32_t h = node * 0x9E3779B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static inline mem_off_t _gap_tree_max(pool_mgr_pt pool_mgr, uint32_t node) {
+    return (node == NODE_NIL) ? 0 : pool_mgr->gap_links[node].max;
+}
+
+static inline void _gap_tree_update(pool_mgr_pt pool_mgr, uint32_t node) {
+    gap_link_pt link = &pool_mgr->gap_links[node];
+    mem_off_t max = (mem_off_t) _node_size(&pool_mgr->node_heap[node]);
+    mem_off_t left = _gap_tree_max(pool_mgr, link->left);
+    mem_off_t right = _gap_tree_max(pool_mgr, link->right);
+    if(left > max) {
+        max = left;
+    }
+    if(right > max) {
+        max = right;
+    }
+    link->max = max;
+}
+
+// split the tree at root into gaps below offset (*left) and the rest (*right)
+static void _gap_tree_split(pool_mgr_pt pool_mgr, uint32_t root, mem_off_t offset,
+                            uint32_t *left, uint32_t *right) {
+    if(root == NODE_NIL) {
+        *left = *right = NODE_NIL;
+        return;
+    }
+    gap_link_pt link = &pool_mgr->gap_links[root];
+    if(pool_mgr->node_heap[root].offset < offset) {
+        _gap_tree_split(pool_mgr, link->right, offset, &link->right, right);
+        *left = root;
+    }
+    else {
+        _gap_tree_split(pool_mgr, link->left, offset, left, &link->left);
+        *right = root;
+    }
+    _gap_tree_update(pool_mgr, root);
+}
+
+// join two trees, all gaps in left being below all gaps in right
+static uint32_t _gap_tree_join(pool_mgr_pt pool_mgr, uint32_t left, uint32_t right) {
+    if(left == NODE_NIL) {
+        return right;
+    }
+    if(right == NODE_NIL) {
+        return left;
+    }
+    if(_gap_tree_priority(left) > _gap_tree_priority(right)) {
+        pool_mgr->gap_links[left].right = _gap_tree_join(pool_mgr, pool_mgr->gap_links[left].right, right);
+        _gap_tree_update(pool_mgr, left);
+        return left;
+    }
+    pool_mgr->gap_links[right].left = _gap_tree_join(pool_mgr, left, pool_mgr->gap_links[right].left);
+    _gap_tree_update(pool_mgr, right);
+    return right;
+}
+
+static uint32_t _mem_gap_tree_insert(pool_mgr_pt pool_mgr, uint32_t root, uint32_t node) {
+    gap_link_pt link = &pool_mgr->gap_links[node];
+    if(root == NODE_NIL || _gap_tree_priority(node) > _gap_tree_priority(root)) {
+        _gap_tree_split(pool_mgr, root, pool_mgr->node_heap[node].offset, &link->left, &link->right);
+        _gap_tree_update(pool_mgr, node);
+        return node;
+    }
+    gap_link_pt rootLink = &pool_mgr->gap_links[root];
+    if(pool_mgr->node_heap[node].offset < pool_mgr->node_heap[root].offset) {
+        rootLink->left = _mem_gap_tree_insert(pool_mgr, rootLink->left, node);
+    }
+    else {
+        rootLink->right = _mem_gap_tree_insert(pool_mgr, rootLink->right, node);
+    }
+    _gap_tree_update(pool_mgr, root);
+    return root;
+}
+
+static uint32_t _mem_gap_tree_remove(pool_mgr_pt pool_mgr, uint32_t root, uint32_t node) {
+    assert(root != NODE_NIL);
+    gap_link_pt rootLink = &pool_mgr->gap_links[root];
+    if(root == node) {
+        return _gap_tree_join(pool_mgr, rootLink->left, rootLink->right);
+    }
+    if(pool_mgr->node_heap[node].offset < pool_mgr->node_heap[root].offset) {
+        rootLink->left = _mem_gap_tree_remove(pool_mgr, rootLink->left, node);
+    }
+    else {
+        rootLink->right = _mem_gap_tree_remove(pool_mgr, rootLink->right, node);
+    }
+    _gap_tree_update(pool_mgr, root);
+    return root;
+}
+
+// the lowest-addressed gap of at least size bytes, same as walking the list
+static uint32_t _mem_gap_tree_first_fit(pool_mgr_pt pool_mgr, size_t size) {
+    uint32_t node = pool_mgr->gap_root;
+    if(_gap_tree_max(pool_mgr, node) < size) {
+        return NODE_NIL;
+    }
+    while(node != NODE_NIL) {
+        gap_link_pt link = &pool_mgr->gap_links[node];
+        if(_gap_tree_max(pool_mgr, link->left) >= size) {
+            node = link->left;
+        }
+        else if(_node_size(&pool_mgr->node_heap[node]) >= size) {
+            return node;
+        }
+        else {
+            node = link->right;
+        }
+    }
+    return NODE_NIL;
+}
+#else
+
+
+
+/*****************************************/
+/*                                       */
+/* Gap list (FIRST_FIT)                  */
+/*                                       */
+/*****************************************/
+// the gaps in address order, apart from the allocations; gaps are mostly
+// removed and added again at the same position (a split gap, a merge), so
+// the position of the last removed gap is tried before searching
+
+static void _mem_gap_list_insert(pool_mgr_pt pool_mgr, uint32_t node) {
+    gap_link_pt links = pool_mgr->gap_links;
+    mem_off_t offset = pool_mgr->node_heap[node].offset;
+    // the gap goes after prev (NODE_NIL: at the head); the hint may be
+    // stale, i.e. no longer a gap, in which case it is not in the list
+    uint32_t prev = pool_mgr->gap_hint;
+    if(prev != NODE_NIL && !_node_is_gap(&pool_mgr->node_heap[prev])) {
+        prev = NODE_NIL;
+    }
+    uint32_t next = (prev == NODE_NIL) ? pool_mgr->gap_root : links[prev].next;
+    if((prev != NODE_NIL && pool_mgr->node_heap[prev].offset > offset) ||
+       (next != NODE_NIL && pool_mgr->node_heap[next].offset < offset)) {
+        prev = NODE_NIL;
+        next = pool_mgr->gap_root;
+        while(next != NODE_NIL && pool_mgr->node_heap[next].offset < offset) {
+            prev = next;
+            next = links[next].next;
+        }
+    }
+    links[node].prev = prev;
+    links[node].next = next;
+    if(prev == NODE_NIL) {
+        pool_mgr->gap_root = node;
+    }
+    else {
+        links[prev].next = node;
+    }
+    if(next != NODE_NIL) {
+        links[next].prev = node;
+    }
+}
+
+static void _mem_gap_list_remove(pool_mgr_pt pool_mgr, uint32_t node) {
+    gap_link_pt links = pool_mgr->gap_links;
+    if(links[node].prev == NODE_NIL) {
+        pool_mgr->gap_root = links[node].next;
+    }
+    else {
+        links[links[node].prev].next = links[node].next;
+    }
+    if(links[node].next != NODE_NIL) {
+        links[links[node].next].prev = links[node].prev;
+    }
+    pool_mgr->gap_hint = links[node].prev;
+}
+
+static uint32_t _mem_gap_list_first_fit(pool_mgr_pt pool_mgr, size_t size) {
+    for(uint32_t node = pool_mgr->gap_root; node != NODE_NIL; node = pool_mgr->gap_links[node].next) {
+        if(_node_size(&pool_mgr->node_heap[node]) >= size) {
+            return node;
+        }
+    }
+    return NODE_NIL;
+}
+#endif
+
+
+
+/*****************************************/
+/*                                       */
+/* Boundary-tag mode (POOL_BOUNDARY_TAGS) */
+/*                                       */
+/*****************************************/
+// note: used_nodes counts the blocks, num_gaps the entries of the gap tree
+
+static inline tag_hdr_pt _tag_hdr(pool_mgr_pt pool_mgr, size_t offset) {
+    return (tag_hdr_pt) (pool_mgr->pool.mem + offset);
+}
+
+static inline size_t _tag_size(size_t tag) {
+    return tag & ~TAG_ALLOCATED;
+}
+
+// the usable part of the pool, a whole number of 8-byte words
+static inline size_t _tag_end(pool_mgr_pt pool_mgr) {
+    return pool_mgr->pool.total_size & ~(size_t) 7;
+}
+
+// note: the last block has no block behind it to read its footer, so it
+//       has none (in a reserved pool, the end may not be committed)
+static inline void _tag_set(pool_mgr_pt pool_mgr, size_t offset, size_t size, int allocated) {
+    size_t tag = size | (allocated ? TAG_ALLOCATED : 0);
+    _tag_hdr(pool_mgr, offset)->tag = tag;
+    if(offset + size < _tag_end(pool_mgr)) {
+        *(size_t *) (pool_mgr->pool.mem + offset + size - sizeof(size_t)) = tag;
+    }
+}
+
+// whether an allocated block starts at offset: its tag is in the pool and
+// repeated by its footer (the last block has none), its record fits it
+static int _tag_is_block(pool_mgr_pt pool_mgr, size_t offset) {
+    size_t end = _tag_end(pool_mgr);
+    // nothing past the committed memory of a reserved pool is read
+    if((pool_mgr->flags & POOL_RESERVE) && end > pool_mgr->committed) {
+        end = pool_mgr->committed;
+    }
+    if(offset % sizeof(size_t) != 0 || offset >= end || end - offset < TAG_MIN_BLOCK) {
+        return 0;
+    }
+    tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset);
+    size_t tag = hdr->tag;
+    size_t size = _tag_size(tag);
+    if(!(tag & TAG_ALLOCATED) || size < TAG_MIN_BLOCK || size > end - offset ||
+       size % sizeof(size_t) != 0) {
+        return 0;
+    }
+    if(offset + size < _tag_end(pool_mgr) &&
+       *(size_t *) (pool_mgr->pool.mem + offset + size - sizeof(size_t)) != tag) {
+        return 0;
+    }
+    return hdr->alloc_record.size <= size - TAG_MIN_BLOCK;
+}
+
+// the gaps are in a treap in their headers: ordered by size, then by
+// address, with priorities hashed from the offset; each gap holds the
+// lowest offset in its subtree, so that the lowest gap of all those past a
+// size is found on the way down (the links and the offset are packed in
+// 8-byte words, see tag_hdr_t)
+
+static inline size_t _tag_link(uint64_t link) {
+    return (link == TAG_LINK_NIL) ? TAG_NIL : (size_t) link * sizeof(size_t);
+}
+
+static inline uint64_t _tag_pack(size_t offset) {
+    return (offset == TAG_NIL) ? TAG_LINK_NIL : (uint64_t) (offset / sizeof(size_t));
+}
+
+static inline size_t _tag_left(pool_mgr_pt pool_mgr, size_t offset) {
+    return _tag_link(_tag_hdr(pool_mgr, offset)->gap.left);
+}
+
+static inline size_t _tag_right(pool_mgr_pt pool_mgr, size_t offset) {
+    return _tag_link(_tag_hdr(pool_mgr, offset)->gap.right);
+}
+
+static inline void _tag_set_left(pool_mgr_pt pool_mgr, size_t offset, size_t left) {
+    _tag_hdr(pool_mgr, offset)->gap.left = _tag_pack(left);
+}
+
+static inline void _tag_set_right(pool_mgr_pt pool_mgr, size_t offset, size_t right) {
+    _tag_hdr(pool_mgr, offset)->gap.right = _tag_pack(right);
+}
+
+// the lowest offset in the subtree at offset, TAG_NIL if it's empty
+static inline size_t _tag_min(pool_mgr_pt pool_mgr, size_t offset) {
+    if(offset == TAG_NIL) {
+        return TAG_NIL;
+    }
+    tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset);
+    return (((size_t) hdr->gap.min_high << 22) | (size_t) hdr->gap.min_low) * sizeof(size_t);
+}
+
+static inline uint32_t _tag_priority(size_t offset) {
+    return (uint32_t) (((uint64_t) offset * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// whether the gap at offset comes before the gap of size at key
+static inline int _tag_before(pool_mgr_pt pool_mgr, size_t offset, size_t size, size_t key) {
+    size_t offsetSize = _tag_size(_tag_hdr(pool_mgr, offset)->tag);
+    return offsetSize < size || (offsetSize == size && offset < key);
+}
+
+static inline void _tag_update(pool_mgr_pt pool_mgr, size_t offset) {
+    tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset);
+    size_t min = offset;
+    size_t left = _tag_min(pool_mgr, _tag_link(hdr->gap.left));
+    size_t right = _tag_min(pool_mgr, _tag_link(hdr->gap.right));
+    if(left < min) {
+        min = left;
+    }
+    if(right < min) {
+        min = right;
+    }
+    min /= sizeof(size_t);
+    hdr->gap.min_low = min & ((1u << 22) - 1);
+    hdr->gap.min_high = min >> 22;
+}
+
+// split the tree at root into the gaps before the gap of size at key
+// (*left) and the rest (*right)
+static void _tag_split(pool_mgr_pt pool_mgr, size_t root, size_t size, size_t key,
+                       size_t *left, size_t *right) {
+    if(root == TAG_NIL) {
+        *left = *right = TAG_NIL;
+        return;
+    }
+    size_t link;
+    if(_tag_before(pool_mgr, root, size, key)) {
+        _tag_split(pool_mgr, _tag_right(pool_mgr, root), size, key, &link, right);
+        _tag_set_right(pool_mgr, root, link);
+        *left = root;
+    }
+    else {
+        _tag_split(pool_mgr, _tag_left(pool_mgr, root), size, key, left, &link);
+        _tag_set_left(pool_mgr, root, link);
+        *right = root;
+    }
+    _tag_update(pool_mgr, root);
+}
+
+// join two trees, all gaps in left coming before all gaps in right
+static size_t _tag_join(pool_mgr_pt pool_mgr, size_t left, size_t right) {
+    if(left == TAG_NIL) {
+        return right;
+    }
+    if(right == TAG_NIL) {
+        return left;
+    }
+    if(_tag_priority(left) > _tag_priority(right)) {
+        _tag_set_right(pool_mgr, left, _tag_join(pool_mgr, _tag_right(pool_mgr, left), right));
+        _tag_update(pool_mgr, left);
+        return left;
+    }
+    _tag_set_left(pool_mgr, right, _tag_join(pool_mgr, left, _tag_left(pool_mgr, right)));
+    _tag_update(pool_mgr, right);
+    return right;
+}
+
+static size_t _tag_tree_insert(pool_mgr_pt pool_mgr, size_t root, size_t offset, size_t size) {
+    if(root == TAG_NIL || _tag_priority(offset) > _tag_priority(root)) {
+        size_t left, right;
+        _tag_split(pool_mgr, root, size, offset, &left, &right);
+        _tag_set_left(pool_mgr, offset, left);
+        _tag_set_right(pool_mgr, offset, right);
+        _tag_update(pool_mgr, offset);
+        return offset;
+    }
+    if(_tag_before(pool_mgr, root, size, offset)) {
+        _tag_set_right(pool_mgr, root, _tag_tree_insert(pool_mgr, _tag_right(pool_mgr, root), offset, size));
+    }
+    else {
+        _tag_set_left(pool_mgr, root, _tag_tree_insert(pool_mgr, _tag_left(pool_mgr, root), offset, size));
+    }
+    _tag_update(pool_mgr, root);
+    return root;
+}
+
+static size_t _tag_tree_remove(pool_mgr_pt pool_mgr, size_t root, size_t offset, size_t size) {
+    assert(root != TAG_NIL);
+    if(root == offset) {
+        return _tag_join(pool_mgr, _tag_left(pool_mgr, root), _tag_right(pool_mgr, root));
+    }
+    if(_tag_before(pool_mgr, root, size, offset)) {
+        _tag_set_right(pool_mgr, root, _tag_tree_remove(pool_mgr, _tag_right(pool_mgr, root), offset, size));
+    }
+    else {
+        _tag_set_left(pool_mgr, root, _tag_tree_remove(pool_mgr, _tag_left(pool_mgr, root), offset, size));
+    }
+    _tag_update(pool_mgr, root);
+    return root;
+}
+
+// put the gap at offset into the tree, its tag set
+static void _tag_insert_gap(pool_mgr_pt pool_mgr, size_t offset) {
+    size_t size = _tag_size(_tag_hdr(pool_mgr, offset)->tag);
+    pool_mgr->tag_root = _tag_tree_insert(pool_mgr, pool_mgr->tag_root, offset, size);
+    pool_mgr->pool.num_gaps++;
+}
+
+// take the gap at offset out of the tree, before its tag changes
+static void _tag_remove_gap(pool_mgr_pt pool_mgr, size_t offset) {
+    size_t size = _tag_size(_tag_hdr(pool_mgr, offset)->tag);
+    pool_mgr->tag_root = _tag_tree_remove(pool_mgr, pool_mgr->tag_root, offset, size);
+    pool_mgr->pool.num_gaps--;
+}
+
+// FIRST_FIT: the lowest gap of at least need; every gap that fits is
+// either on the way down to the first one that does or to the right of
+// it, so the lowest offsets of those right subtrees have the answer
+static size_t _tag_first_fit(pool_mgr_pt pool_mgr, size_t need) {
+    size_t first = TAG_NIL;
+    for(size_t node = pool_mgr->tag_root; node != TAG_NIL; ) {
+        if(_tag_size(_tag_hdr(pool_mgr, node)->tag) >= need) {
+            size_t right = _tag_min(pool_mgr, _tag_right(pool_mgr, node));
+            if(node < first) {
+                first = node;
+            }
+            if(right < first) {
+                first = right;
+            }
+            node = _tag_left(pool_mgr, node);
+        }
+        else {
+            node = _tag_right(pool_mgr, node);
+        }
+    }
+    return first;
+}
+
+// BEST_FIT: the smallest gap of at least need, the lowest of equals: the
+// first gap in the order of the tree that fits
+static size_t _tag_best_fit(pool_mgr_pt pool_mgr, size_t need) {
+    size_t best = TAG_NIL;
+    for(size_t node = pool_mgr->tag_root; node != TAG_NIL; ) {
+        if(_tag_size(_tag_hdr(pool_mgr, node)->tag) >= need) {
+            best = node;
+            node = _tag_left(pool_mgr, node);
+        }
+        else {
+            node = _tag_right(pool_mgr, node);
+        }
+    }
+    return best;
+}
+
+static alloc_status _mem_tag_init(pool_mgr_pt pool_mgr) {
+    size_t end = _tag_end(pool_mgr);
+    // the pool has to hold at least one (empty) block
+    if(end < TAG_MIN_BLOCK) {
+        return ALLOC_FAIL;
+    }
+    // the whole pool is one gap
+    _tag_set(pool_mgr, 0, end, 0);
+    pool_mgr->tag_root = TAG_NIL;
+    pool_mgr->pool.num_gaps = 0;
+    _tag_insert_gap(pool_mgr, 0);
+    pool_mgr->used_nodes = 1;
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+    return ALLOC_OK;
+}
+
+static alloc_pt _mem_tag_new_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    if(size > _tag_end(pool_mgr)) {
+        return NULL;
+    }
+    size_t need = MEM_TAG_BLOCK_SIZE(size);
+    // search the gap tree:
+    //   FIRST_FIT takes the lowest sufficient gap
+    //   BEST_FIT takes the smallest, the lowest of equals
+    size_t found = (pool_mgr->pool.policy == FIRST_FIT)
+                   ? _tag_first_fit(pool_mgr, need)
+                   : _tag_best_fit(pool_mgr, need);
+    if(found == TAG_NIL) {
+        return NULL;
+    }
+    size_t foundSize = _tag_size(_tag_hdr(pool_mgr, found)->tag);
+    // make sure the memory is committed, with the header of the remainder
+    if((pool_mgr->flags & POOL_RESERVE) &&
+       _mem_commit(pool_mgr, found + ((foundSize - need >= TAG_MIN_BLOCK) ? need + sizeof(tag_hdr_t)
+                                                                         : foundSize)) != ALLOC_OK) {
+        return NULL;
+    }
+    // the record is in the header, right before the payload, over the
+    // links of the gap: it is written before the tag makes it a block,
+    // so that a crash in between leaves a gap (for a file pool)
+    // (a shared pool gets its record in this process first, the header
+    // keeps no address of any process's mapping)
+    alloc_pt record = NULL;
+    if((pool_mgr->flags & MEM_POOL_SHARED) && (record = _mem_shared_record(pool_mgr, found)) == NULL) {
+        return NULL;
+    }
+    tag_hdr_pt gap = _tag_hdr(pool_mgr, found);
+    _tag_remove_gap(pool_mgr, found);
+    gap->alloc_record.size = size;
+    gap->alloc_record.mem = (record != NULL) ? NULL : (char *) (gap + 1);
+    atomic_signal_fence(memory_order_seq_cst);
+    // split off the rest if it can hold a block, the remainder goes back
+    // into the tree; otherwise hand out the whole gap
+    if(foundSize - need >= TAG_MIN_BLOCK) {
+        _tag_set(pool_mgr, found + need, foundSize - need, 0);
+        _tag_insert_gap(pool_mgr, found + need);
+        _tag_set(pool_mgr, found, need, 1);
+        pool_mgr->used_nodes++;
+    }
+    else {
+        _tag_set(pool_mgr, found, foundSize, 1);
+    }
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    // gaps aren't aged here, so which were purged isn't known: forget all
+    if(pool_mgr->pool.purged_size != 0) {
+        _mem_purged_add(pool_mgr, -(ptrdiff_t) pool_mgr->pool.purged_size);
+    }
+    if(record != NULL) {
+        record->size = size;
+        return record;
+    }
+    return &gap->alloc_record;
+}
+
+static alloc_status _mem_tag_del_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    // the header is around the record, or a shared record knows it
+    size_t offset;
+    if(pool_mgr->flags & MEM_POOL_SHARED) {
+        offset = _mem_shared_record_offset(pool_mgr, alloc);
+    }
+    else {
+        char *hdr = (char *) alloc - offsetof(tag_hdr_t, alloc_record);
+        offset = (hdr < pool_mgr->pool.mem) ? TAG_NIL : (size_t) (hdr - pool_mgr->pool.mem);
+    }
+    size_t end = _tag_end(pool_mgr);
+    if(offset == TAG_NIL || !_tag_is_block(pool_mgr, offset)) {
+        return ALLOC_FAIL;
+    }
+    tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset);
+    size_t block = offset;
+    size_t size = _tag_size(hdr->tag);
+    // a freed root is no root
+    if((pool_mgr->flags & MEM_POOL_FILE) && pool_mgr->file->root == offset) {
+        pool_mgr->file->root = TAG_NIL;
+    }
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.alloc_size -= hdr->alloc_record.size;
+    if(pool_mgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_record_drop(pool_mgr, block);
+    }
+    // the neighbors are found by address arithmetic:
+    //   the next block starts where this one ends
+    //   the previous block's footer is right before this header
+    size_t next = offset + size;
+    int nextIsGap = next < end && !(_tag_hdr(pool_mgr, next)->tag & TAG_ALLOCATED);
+    int prevIsGap = offset > 0 &&
+            !(*(size_t *) (pool_mgr->pool.mem + offset - sizeof(size_t)) & TAG_ALLOCATED);
+    // the gaps merged with it leave the tree, the whole goes back in
+    if(prevIsGap) {
+        size_t prevSize = *(size_t *) (pool_mgr->pool.mem + offset - sizeof(size_t));
+        offset -= prevSize;
+        size += prevSize;
+        _tag_remove_gap(pool_mgr, offset);
+        pool_mgr->used_nodes--;
+    }
+    if(nextIsGap) {
+        size += _tag_size(_tag_hdr(pool_mgr, next)->tag);
+        _tag_remove_gap(pool_mgr, next);
+        pool_mgr->used_nodes--;
+    }
+    _tag_set(pool_mgr, offset, size, 0);
+    // the headers inside the merged gap are no blocks anymore, so that a
+    // second free of the block fails; cleared once the gap covers them
+    atomic_signal_fence(memory_order_seq_cst);
+    if(block != offset) {
+        _tag_hdr(pool_mgr, block)->tag = 0;
+    }
+    if(nextIsGap) {
+        _tag_hdr(pool_mgr, next)->tag = 0;
+    }
+    _tag_insert_gap(pool_mgr, offset);
+    return ALLOC_OK;
+}
+
+// the record of the block whose payload is at offset, pointed at the
+// payload in this mapping of the pool (a shared pool's is this process's
+// own); NULL unless a block starts there, not just a word that looks like
+// an allocated tag
+static alloc_pt _mem_tag_alloc_at(pool_mgr_pt pool_mgr, size_t offset) {
+    if(offset < sizeof(tag_hdr_t) || !_tag_is_block(pool_mgr, offset - sizeof(tag_hdr_t))) {
+        return NULL;
+    }
+    tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset - sizeof(tag_hdr_t));
+    if(pool_mgr->flags & MEM_POOL_SHARED) {
+        alloc_pt record = _mem_shared_record(pool_mgr, offset - sizeof(tag_hdr_t));
+        if(record != NULL) {
+            record->size = hdr->alloc_record.size;
+        }
+        return record;
+    }
+    hdr->alloc_record.mem = (char *) (hdr + 1);
+    return &hdr->alloc_record;
+}
+
+// seqlock reader: the blocks in address order, or capacity + 1 when a
+// tag was changing under the walk (the caller retries)
+static unsigned _mem_tag_read_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                       unsigned capacity) {
+    size_t end = _tag_end(pool_mgr);
+    unsigned i = 0;
+    for(size_t offset = 0; offset < end; i++) {
+        size_t tag = MEM_READ_ONCE(_tag_hdr(pool_mgr, offset)->tag);
+        size_t size = _tag_size(tag);
+        if(size < TAG_MIN_BLOCK || size > end - offset || i == capacity) {
+            return capacity + 1;
+        }
+        segments[i].size = size;
+        segments[i].allocated = (tag & TAG_ALLOCATED) ? 1 : 0;
+        offset += size;
+    }
+    return i;
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* Sharded pools                         */
+/*                                       */
+/*****************************************/
+// the shards are independent pools over consecutive slices of the
+// parent's memory, each behind its own lock; allocations go to the
+// shard of the current CPU first, frees to the shard holding the address
+
+static alloc_status _mem_sharded_close(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->shards != NULL) {
+        for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+            _mem_free_pool_mgr(pool_mgr->shards[i]);
+        }
+    }
+    free(pool_mgr->shards);
+    free(pool_mgr->pool.mem);
+    free(pool_mgr);
+    return ALLOC_OK;
+}
+
+static alloc_pt _mem_sharded_new_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    int cpu = sched_getcpu();
+    unsigned first = (cpu < 0) ? 0 : (unsigned) cpu % pool_mgr->num_shards;
+    // steal from the other shards when the local one can't fit the size
+    for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+        pool_mgr_pt shard = pool_mgr->shards[(first + i) % pool_mgr->num_shards];
+        pthread_mutex_lock(&shard->lock);
+        alloc_pt alloc = mem_new_alloc((pool_pt) shard, size);
+        pthread_mutex_unlock(&shard->lock);
+        if(alloc != NULL) {
+            return alloc;
+        }
+    }
+    return NULL;
+}
+
+static alloc_status _mem_sharded_del_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    pool_mgr_pt shard = _mem_shard_of(pool_mgr, alloc->mem);
+    if(shard == NULL) {
+        return ALLOC_FAIL;
+    }
+    pthread_mutex_lock(&shard->lock);
+    alloc_status status = mem_del_alloc((pool_pt) shard, alloc);
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+// the shard an address is in, NULL if it's outside the pool
+static pool_mgr_pt _mem_shard_of(pool_mgr_pt pool_mgr, const char *mem) {
+    if(mem < pool_mgr->pool.mem || mem >= pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return NULL;
+    }
+    // the last shard also holds the remainder
+    size_t i = (size_t) (mem - pool_mgr->pool.mem) / pool_mgr->shard_size;
+    if(i >= pool_mgr->num_shards) {
+        i = pool_mgr->num_shards - 1;
+    }
+    return pool_mgr->shards[i];
+}
+
+// the shards' segments in address order, each read under its seqlock;
+// the parent pool_t is only read, other threads may be reading it too
+// (mem_pool_stats adds up the shards' counters)
+static void _mem_sharded_inspect_pool(pool_mgr_pt pool_mgr, pool_segment_pt *segments,
+                                      unsigned *num_segments) {
+    pool_segment_pt *shardSegments = calloc(pool_mgr->num_shards, sizeof(pool_segment_pt));
+    unsigned *shardNumSegments = calloc(pool_mgr->num_shards, sizeof(unsigned));
+    pool_segment_pt segmentArray = NULL;
+    unsigned total = 0;
+    *segments = NULL;
+    *num_segments = 0;
+    if(shardSegments == NULL || shardNumSegments == NULL) {
+        free(shardSegments);
+        free(shardNumSegments);
+        return;
+    }
+    for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+        mem_inspect_pool((pool_pt) pool_mgr->shards[i], &shardSegments[i], &shardNumSegments[i]);
+        total += shardNumSegments[i];
+    }
+    // a shard that couldn't be walked fails the whole pool
+    for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+        if(shardSegments[i] == NULL) {
+            total = 0;
+        }
+    }
+    segmentArray = (total != 0) ? calloc(total, sizeof(pool_segment_t)) : NULL;
+    if(segmentArray != NULL) {
+        unsigned n = 0;
+        for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+            if(shardSegments[i] != NULL) {
+                memcpy(&segmentArray[n], shardSegments[i], shardNumSegments[i] * sizeof(pool_segment_t));
+                n += shardNumSegments[i];
+            }
+        }
+        *segments = segmentArray;
+        *num_segments = n;
     }
-    *segments = segmentArray;
-    *num_segments = memPoolMgr->used_nodes;
-    //printf("leaving mem_inspect_pool\n");
+    for(unsigned i = 0; i < pool_mgr->num_shards; i++) {
+        free(shardSegments[i]);
+    }
+    free(shardSegments);
+    free(shardNumSegments);
 }
 
 
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store() {
-    // check if necessary
-    /*
-                if (((float) pool_store_size / pool_store_capacity)
-                    > MEM_POOL_STORE_FILL_FACTOR) {...}
-     */
-    if(((float) pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
-        pool_store = (pool_mgr_pt*) realloc(pool_store, sizeof(pool_mgr_pt) * pool_store_capacity * MEM_EXPAND_FACTOR);
-        if(pool_store == NULL) {
-            return ALLOC_FAIL;
+/*****************************************/
+/*                                       */
+/* Maintenance thread                    */
+/*                                       */
+/*****************************************/
+// a pass every interval (or on a wake-up) over the POOL_BACKGROUND pools
+// in the pool store, round robin, until the budget is spent; a pool the
+// owner is using is skipped, never waited for, and the owner waits at
+// most for the work on one pool
+
+static void *_mem_maint_main(void *arg) {
+    pthread_mutex_lock(&maint_lock);
+    while(!maint_stop) {
+        // sleep until the next pass is due, or a wake-up
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += maint_opts.interval_ms / 1000;
+        deadline.tv_nsec += (long) (maint_opts.interval_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
-        else {
-            pool_store_capacity *= MEM_EXPAND_FACTOR;
-            return ALLOC_OK;
+        while(!maint_stop && !maint_woken) {
+            if(pthread_cond_timedwait(&maint_cond, &maint_lock, &deadline) != 0) {
+                break;
+            }
+        }
+        if(maint_stop) {
+            break;
+        }
+        maint_woken = 0;
+        unsigned budget = maint_opts.budget;
+        pthread_mutex_unlock(&maint_lock);
+        // the clock the gaps are aged by
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        atomic_store_explicit(&maint_clock, (unsigned) (now.tv_sec * 1000 + now.tv_nsec / 1000000),
+                              memory_order_relaxed);
+
+        // one pass over the pool stores
+        pthread_mutex_lock(&contexts_lock);
+        for(mem_context_pt ctx = contexts; ctx != NULL && budget > 0; ctx = ctx->next) {
+            pthread_mutex_lock(&ctx->lock);
+            for(unsigned n = 0; n < ctx->pool_store_size && budget > 0; n++) {
+                ctx->maint_cursor = (ctx->maint_cursor + 1) % ctx->pool_store_size;
+                pool_mgr_pt pool_mgr = ctx->pool_store[ctx->maint_cursor].mgr;
+                if(pool_mgr == NULL || !(pool_mgr->flags & POOL_BACKGROUND) ||
+                   pthread_mutex_trylock(&pool_mgr->lock) != 0) {
+                    continue;
+                }
+                unsigned work = _mem_maintain_pool(pool_mgr);
+                pthread_mutex_unlock(&pool_mgr->lock);
+                budget = (work < budget) ? budget - work : 0;
+            }
+            pthread_mutex_unlock(&ctx->lock);
         }
+        pthread_mutex_unlock(&contexts_lock);
+
+        pthread_mutex_lock(&maint_lock);
     }
-    else {
-        return ALLOC_OK;
+    pthread_mutex_unlock(&maint_lock);
+    return arg;
+}
+
+// lock (or unlock) the pools of a store the calls lock: the locking
+// pools and the shards of the sharded ones
+static void _mem_fork_lock_pools(mem_context_pt ctx, int lock) {
+    for(unsigned i = 0; i < ctx->pool_store_size; i++) {
+        pool_mgr_pt pool_mgr = ctx->pool_store[i].mgr;
+        if(pool_mgr == NULL) {
+            continue;
+        }
+        if(pool_mgr->flags & MEM_POOL_LOCKING) {
+            if(lock) {
+                pthread_mutex_lock(&pool_mgr->lock);
+            }
+            else {
+                pthread_mutex_unlock(&pool_mgr->lock);
+            }
+        }
+        if(pool_mgr->flags & MEM_POOL_SHARDED) {
+            for(unsigned n = 0; n < pool_mgr->num_shards; n++) {
+                if(lock) {
+                    pthread_mutex_lock(&pool_mgr->shards[n]->lock);
+                }
+                else {
+                    pthread_mutex_unlock(&pool_mgr->shards[n]->lock);
+                }
+            }
+        }
     }
-    // don't forget to update capacity variables
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
-    // see above
-    if(((float) pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
-        pool_mgr->node_heap = realloc(pool_mgr->node_heap, sizeof(node_pt) * pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR);
-        if(pool_mgr->node_heap == NULL) {
-            return ALLOC_FAIL;
+// the mutexes mem_fork_prepare() took, in reverse
+static void _mem_fork_release() {
+    for(mem_context_pt ctx = contexts; ctx != NULL; ctx = ctx->next) {
+        _mem_fork_lock_pools(ctx, 0);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    pthread_mutex_unlock(&contexts_lock);
+    pthread_mutex_unlock(&maint_lock);
+}
+
+// the maintenance of one (locked) pool, returns the nodes visited
+// note: a pool is idle if nothing changed since the last pass
+static unsigned _mem_maintain_pool(pool_mgr_pt pool_mgr) {
+    unsigned seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    int idle = (seq == pool_mgr->maint_seq);
+    unsigned work = 1;
+    // merge the quick lists when the pool is idle or they grow long
+    if(pool_mgr->num_quick > 0 &&
+       (idle || pool_mgr->num_quick >= MEM_QUICK_MERGE_THRESHOLD / 2)) {
+        _mem_write_begin(pool_mgr);
+        _mem_coalesce(pool_mgr);
+        _mem_write_end(pool_mgr);
+        work += pool_mgr->used_nodes;
+        seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+    }
+    int changed = (pool_mgr->purged_seq != seq);
+    // compact the metadata of an idle pool, once
+    if(idle && changed) {
+        _mem_trim_pool(pool_mgr);
+    }
+    // return the free pages to the OS: of the gaps that have been free
+    // for the decay period, when the pool changed since the last purge
+    // or it left gaps to decay; a boundary-tag pool doesn't age its
+    // gaps, so all of them, once the pool is idle
+    int tags = (pool_mgr->flags & POOL_BOUNDARY_TAGS) != 0;
+    if((tags && idle && changed) || (!tags && (changed || pool_mgr->decay_pending))) {
+        _mem_write_begin(pool_mgr);
+        if(tags) {
+            _mem_purge_gaps(pool_mgr);
         }
         else {
-            pool_mgr->total_nodes *= MEM_NODE_HEAP_EXPAND_FACTOR;
-            return ALLOC_OK;
+            pool_mgr->decay_pending = _mem_decay_gaps(pool_mgr, _mem_gap_age_now());
+        }
+        _mem_write_end(pool_mgr);
+        seq = atomic_load_explicit(&pool_mgr->seq, memory_order_relaxed);
+        pool_mgr->purged_seq = seq;
+        work += pool_mgr->used_nodes;
+    }
+    pool_mgr->maint_seq = seq;
+    return work;
+}
+
+// the whole pages in [start, end), returns their size
+static size_t _mem_purge_range(pool_mgr_pt pool_mgr, char *start, char *end) {
+    // nothing past the committed memory of a reserved pool
+    if((pool_mgr->flags & POOL_RESERVE) && end > pool_mgr->pool.mem + pool_mgr->committed) {
+        end = pool_mgr->pool.mem + pool_mgr->committed;
+    }
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t from = ((uintptr_t) start + page - 1) & ~(page - 1);
+    uintptr_t to = (uintptr_t) end & ~(page - 1);
+    if(from >= to) {
+        return 0;
+    }
+    // lazily: the kernel takes the pages only when it needs them
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if(maint_opts.lazy) {
+        advice = MADV_FREE;
+    }
+#endif
+    if(madvise((void *) from, to - from, advice) != 0) {
+        return 0;
+    }
+    return to - from;
+}
+
+// POOL_BOUNDARY_TAGS: the whole pages inside all the gaps, which keep
+// their tags
+static void _mem_purge_gaps(pool_mgr_pt pool_mgr) {
+    char *mem = pool_mgr->pool.mem;
+    size_t end = _tag_end(pool_mgr);
+    size_t purged = 0;
+    for(size_t offset = 0; offset < end; offset += _tag_size(_tag_hdr(pool_mgr, offset)->tag)) {
+        size_t tag = _tag_hdr(pool_mgr, offset)->tag;
+        if(!(tag & TAG_ALLOCATED)) {
+            purged += _mem_purge_range(pool_mgr, mem + offset + sizeof(tag_hdr_t),
+                                       mem + offset + _tag_size(tag) - sizeof(size_t));
+        }
+    }
+    _mem_purged_add(pool_mgr, (ptrdiff_t) purged - (ptrdiff_t) pool_mgr->pool.purged_size);
+}
+
+// the whole pages inside the gaps that have grown and then been left
+// alone for the decay period; returns 1 if some are still to decay
+static int _mem_decay_gaps(pool_mgr_pt pool_mgr, unsigned now) {
+    char *mem = pool_mgr->pool.mem;
+    node_pt heap = pool_mgr->node_heap;
+    gap_age_pt ages = pool_mgr->gap_ages;
+    int pending = 0;
+    for(uint32_t node = 0; node != NODE_NIL; node = heap[node].next) {
+        if(!_node_is_gap(&heap[node]) || !ages[node].dirty) {
+            continue;
+        }
+        if(now - ages[node].since < maint_opts.decay_ms) {
+            pending = 1;
+            continue;
+        }
+        size_t purged = _mem_purge_range(pool_mgr, mem + heap[node].offset,
+                                         mem + heap[node].offset + _node_size(&heap[node]));
+        _mem_purged_add(pool_mgr, (ptrdiff_t) purged - (ptrdiff_t) ages[node].purged);
+        ages[node].purged = (mem_off_t) purged;
+        ages[node].dirty = 0;
+    }
+    return pending;
+}
+
+// the live blocks can't move (the user holds their addresses), so the
+// compaction is of the metadata: free the record chunks of unused nodes
+// and shrink an oversized gap index
+static void _mem_trim_pool(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->flags & POOL_BOUNDARY_TAGS) {
+        return;
+    }
+    for(unsigned c = 0; c < pool_mgr->num_alloc_chunks; c++) {
+        if(pool_mgr->alloc_chunks[c] == NULL) {
+            continue;
+        }
+        unsigned first = c * MEM_ALLOC_CHUNK_RECORDS;
+        unsigned last = first + MEM_ALLOC_CHUNK_RECORDS;
+        if(last > pool_mgr->total_nodes) {
+            last = pool_mgr->total_nodes;
+        }
+        unsigned i = first;
+        while(i < last && !(pool_mgr->node_heap[i].size & NODE_USED)) {
+            i++;
+        }
+        if(i == last) {
+            free(pool_mgr->alloc_chunks[c]);
+            pool_mgr->alloc_chunks[c] = NULL;
+        }
+    }
+    if(pool_mgr->gap_nodes != NULL) {
+        unsigned capacity = pool_mgr->gap_ix_capacity;
+        while(capacity / MEM_GAP_IX_EXPAND_FACTOR >= MEM_GAP_IX_INIT_CAPACITY &&
+              _mem_gap_ix_size(pool_mgr) * MEM_GAP_IX_EXPAND_FACTOR * 2 < capacity) {
+            capacity /= MEM_GAP_IX_EXPAND_FACTOR;
+        }
+        // both arrays are copied into new ones and swapped in together: a
+        // shrinking realloc that fails would leave one of them behind the
+        // capacity of the other
+        if(capacity < pool_mgr->gap_ix_capacity) {
+            mem_off_t *newSizes = malloc(sizeof(mem_off_t) * capacity);
+            uint32_t *newNodes = malloc(sizeof(uint32_t) * capacity);
+            if(newSizes == NULL || newNodes == NULL) {
+                free(newSizes);
+                free(newNodes);
+                return;
+            }
+            unsigned size = _mem_gap_ix_size(pool_mgr);
+            memcpy(newSizes, pool_mgr->gap_sizes, sizeof(mem_off_t) * size);
+            memcpy(newNodes, pool_mgr->gap_nodes, sizeof(uint32_t) * size);
+            free(pool_mgr->gap_sizes);
+            free(pool_mgr->gap_nodes);
+            pool_mgr->gap_sizes = newSizes;
+            pool_mgr->gap_nodes = newNodes;
+            pool_mgr->gap_ix_capacity = capacity;
+        }
+    }
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* NUMA placement                        */
+/*                                       */
+/*****************************************/
+// POOL_NUMA_NODE: the pool is mapped and bound to its node before the
+// first touch, and the metadata is allocated while the thread prefers
+// the node; the system calls are made directly, so there is no libnuma
+// dependency, and a failure (no NUMA, or a node that isn't there)
+// leaves the pool where the kernel puts it
+
+static int _mem_numa_local_node() {
+    unsigned cpu, node;
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return -1;
+    }
+    return (int) node;
+}
+
+// *numa_node is set to -1 if the region couldn't be bound
+static void _mem_numa_bind(char *mem, size_t size, int *numa_node) {
+    if(*numa_node >= 0) {
+        unsigned long mask = 1UL << *numa_node;
+        if(syscall(SYS_mbind, mem, size, MPOL_BIND, &mask, MEM_NUMA_MASK_BITS, 0) != 0) {
+            *numa_node = -1;
+        }
+    }
+}
+
+static void _mem_numa_enter(int numa_node, numa_policy_t *saved) {
+    saved->placed = 0;
+    if(numa_node < 0) {
+        return;
+    }
+    if(syscall(SYS_get_mempolicy, &saved->mode, &saved->mask, MEM_NUMA_MASK_BITS, NULL, 0) != 0) {
+        return;
+    }
+    // preferred, not bound: metadata may go elsewhere rather than fail
+    unsigned long mask = 1UL << numa_node;
+    saved->placed = (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MEM_NUMA_MASK_BITS) == 0);
+}
+
+static void _mem_numa_leave(const numa_policy_t *saved) {
+    if(saved->placed) {
+        syscall(SYS_set_mempolicy, saved->mode, &saved->mask, MEM_NUMA_MASK_BITS);
+    }
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* File-backed pools                     */
+/*                                       */
+/*****************************************/
+// a boundary-tag pool in a shared mapping of a file, behind a header;
+// the tags and the gap tree are offsets, so the only pointers in the
+// file are the mem fields of the allocation records, which are right
+// as long as the file is mapped at the same address (the header keeps
+// it, and a reopen asks for it)
+// crash consistency: the counters in the header are written on close,
+// together with the clean flag; a file that wasn't closed cleanly is
+// recovered by a scan of the tags, in which the blocks are walked by
+// their headers only, the footers and the gap tree are rebuilt, and
+// the counters are recounted (an operation cut short leaves the block
+// headers either before or after it, not in between)
+
+// *size is the size of the pool: the size of a new file (create), or
+// (when 0 or the same) of an existing one; the caller publishes a new
+// file with the magic, once the pool is formatted
+static char *_mem_file_map(int fd, size_t *size, int create) {
+    struct stat st;
+    file_hdr_t hdr;
+    void *hint = NULL;
+    if(fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if(create) {
+        // a new file: the header and the pool
+        if(*size == 0 || *size > (size_t) SIZE_MAX - MEM_FILE_HDR_SIZE ||
+           ftruncate(fd, (off_t) (MEM_FILE_HDR_SIZE + *size)) != 0) {
+            return NULL;
         }
     }
     else {
-        return ALLOC_OK;
+        // an existing file has to be a pool of the size asked for
+        if(pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr) ||
+           hdr.magic != MEM_FILE_MAGIC || hdr.version != MEM_FILE_VERSION ||
+           (uint64_t) st.st_size != MEM_FILE_HDR_SIZE + hdr.total_size ||
+           (*size != 0 && *size != hdr.total_size)) {
+            return NULL;
+        }
+        *size = (size_t) hdr.total_size;
+        if(hdr.base > MEM_FILE_HDR_SIZE) {
+            hint = (void *) (uintptr_t) (hdr.base - MEM_FILE_HDR_SIZE);
+        }
+    }
+    // try the address of the last mapping, else anywhere
+    size_t len = MEM_FILE_HDR_SIZE + *size;
+    void *map = MAP_FAILED;
+#ifdef MAP_FIXED_NOREPLACE
+    if(hint != NULL) {
+        map = mmap(hint, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    }
+#endif
+    if(map == MAP_FAILED) {
+        map = mmap(hint, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if(map == MAP_FAILED) {
+        return NULL;
+    }
+    if(create) {
+        file_hdr_pt newHdr = (file_hdr_pt) map;
+        newHdr->version = MEM_FILE_VERSION;
+        newHdr->total_size = *size;
     }
+    return (char *) map;
 }
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
-    //printf("_mem_resize_gap_ix\n");
-    // see above
-    /*if(((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity) > MEM_GAP_IX_FILL_FACTOR) {
-        pool_mgr->gap_ix_capacity *= MEM_GAP_IX_EXPAND_FACTOR;
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, sizeof(gap_pt) * pool_mgr->gap_ix_capacity);
-        if(pool_mgr->gap_ix == NULL) {
-            pool_mgr->gap_ix_capacity /= MEM_GAP_IX_EXPAND_FACTOR;
+// rebuild the pool from the block headers; fails if they don't tile it
+static alloc_status _mem_file_recover(pool_mgr_pt pool_mgr) {
+    size_t end = _tag_end(pool_mgr);
+    size_t lastGap = TAG_NIL;
+    size_t lastGapEnd = TAG_NIL;
+    pool_mgr->tag_root = TAG_NIL;
+    pool_mgr->used_nodes = 0;
+    pool_mgr->pool.num_gaps = 0;
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.alloc_size = 0;
+    for(size_t offset = 0; offset < end; ) {
+        tag_hdr_pt hdr = _tag_hdr(pool_mgr, offset);
+        size_t size = _tag_size(hdr->tag);
+        if(size < TAG_MIN_BLOCK || size > end - offset || size % sizeof(size_t) != 0) {
             return ALLOC_FAIL;
         }
+        if(hdr->tag & TAG_ALLOCATED) {
+            // a record that doesn't fit its block wasn't written (by an
+            // older version, which set the tag first): it gets the block
+            if(hdr->alloc_record.size > size - MEM_TAG_BLOCK_SIZE(0)) {
+                hdr->alloc_record.size = size - MEM_TAG_BLOCK_SIZE(0);
+            }
+            // the record points into this mapping (a shared pool's
+            // records are each process's own)
+            hdr->alloc_record.mem = (pool_mgr->flags & MEM_POOL_SHARED) ? NULL : (char *) (hdr + 1);
+            _tag_set(pool_mgr, offset, size, 1);
+            pool_mgr->pool.num_allocs++;
+            pool_mgr->pool.alloc_size += hdr->alloc_record.size;
+            pool_mgr->used_nodes++;
+        }
+        else if(lastGapEnd == offset) {
+            // a gap right behind a gap is merged into it
+            _tag_remove_gap(pool_mgr, lastGap);
+            _tag_set(pool_mgr, lastGap, lastGapEnd + size - lastGap, 0);
+            _tag_insert_gap(pool_mgr, lastGap);
+            lastGapEnd += size;
+        }
         else {
-            return ALLOC_OK;
+            _tag_set(pool_mgr, offset, size, 0);
+            _tag_insert_gap(pool_mgr, offset);
+            pool_mgr->used_nodes++;
+            lastGap = offset;
+            lastGapEnd = offset + size;
         }
+        offset += size;
     }
-    else {
+    // a root that isn't an allocation anymore is dropped
+    size_t root = pool_mgr->file->root;
+    if(root != TAG_NIL && (root >= end || !(_tag_hdr(pool_mgr, root)->tag & TAG_ALLOCATED))) {
+        pool_mgr->file->root = TAG_NIL;
+    }
+    return ALLOC_OK;
+}
+
+// write the counters and mark the file clean, after the pool is on disk
+static void _mem_file_save(pool_mgr_pt pool_mgr) {
+    file_hdr_pt hdr = pool_mgr->file;
+    msync(hdr, MEM_FILE_HDR_SIZE + pool_mgr->pool.total_size, MS_SYNC);
+    hdr->tag_root = pool_mgr->tag_root;
+    hdr->used_nodes = pool_mgr->used_nodes;
+    hdr->alloc_size = pool_mgr->pool.alloc_size;
+    hdr->num_allocs = pool_mgr->pool.num_allocs;
+    hdr->num_gaps = pool_mgr->pool.num_gaps;
+    hdr->base = (uintptr_t) pool_mgr->pool.mem;
+    hdr->clean = 1;
+    msync(hdr, MEM_FILE_HDR_SIZE, MS_SYNC);
+}
+
+// the root is kept as the offset of its block
+static alloc_status _mem_file_set_root(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    // null clears the root
+    if(alloc == NULL) {
+        pool_mgr->file->root = TAG_NIL;
         return ALLOC_OK;
-    }*/
-    int arrayFull = 0;
-    for(int i = 0; i < pool_mgr->gap_ix_capacity; i++) {
-        if(pool_mgr->gap_ix[i].node == NULL) {
-            arrayFull = 1;
-            break;
-        }
     }
-    if(arrayFull == 1) {
-        return ALLOC_FAIL;
+    // the header is around the record, or a shared record knows it; it
+    // has to be a block of the pool's
+    size_t offset;
+    if(pool_mgr->flags & MEM_POOL_SHARED) {
+        offset = _mem_shared_record_offset(pool_mgr, alloc);
     }
     else {
-        return ALLOC_OK;
+        char *hdr = (char *) alloc - offsetof(tag_hdr_t, alloc_record);
+        offset = (hdr < pool_mgr->pool.mem) ? TAG_NIL : (size_t) (hdr - pool_mgr->pool.mem);
+    }
+    if(offset == TAG_NIL || !_tag_is_block(pool_mgr, offset)) {
+        return ALLOC_FAIL;
     }
+    pool_mgr->file->root = offset;
+    return ALLOC_OK;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node) {
-    //printf("_mem_add_to_gap_ix\n");
+static alloc_pt _mem_file_get_root(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->file->root == TAG_NIL) {
+        return NULL;
+    }
+    // another process may have set it, in another mapping
+    return _mem_tag_alloc_at(pool_mgr, pool_mgr->file->root + sizeof(tag_hdr_t));
+}
 
-    // expand the gap index, if necessary (call the function)
-    _mem_resize_gap_ix(pool_mgr);
-    // add the entry at the end
-    for(int i = 0; i < pool_mgr->gap_ix_capacity; i++) {
-        if(pool_mgr->gap_ix[i].size == 0) {
-            pool_mgr->gap_ix[i].size = size;
-            pool_mgr->gap_ix[i].node = node;
-            i = pool_mgr->gap_ix_capacity;
+// link the pool mgr to the pool store
+static pool_pt _mem_file_register(pool_mgr_pt pool_mgr) {
+    if(_mem_pool_store_add(&default_context, pool_mgr) != ALLOC_OK) {
+        if(!(pool_mgr->flags & MEM_POOL_SHARED)) {
+            _mem_file_save(pool_mgr);
         }
+        _mem_free_pool_mgr(pool_mgr);
+        return NULL;
     }
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps++;
-    // sort the gap index (call the function)
-    _mem_sort_gap_ix(pool_mgr);
-    // check success
+    return (pool_pt) pool_mgr;
+}
+
 
+
+/*****************************************/
+/*                                       */
+/* Shared pools (MEM_POOL_SHARED)        */
+/*                                       */
+/*****************************************/
+// a file-backed pool in shared memory, open in several processes at
+// once, each with its own pool_mgr; the counters live in the header and
+// are brought in and out of the pool_mgr under the header's lock, which
+// is robust: if a process dies holding it, in the middle of a change,
+// the next one to lock it recovers the pool with a scan
+
+static alloc_status _mem_shared_lock(pool_mgr_pt pool_mgr) {
+    file_hdr_pt hdr = pool_mgr->file;
+    int rc = pthread_mutex_lock(&hdr->lock);
+    if(rc == EOWNERDEAD) {
+        if(_mem_file_recover(pool_mgr) != ALLOC_OK) {
+            // not recoverable: every later lock fails
+            pthread_mutex_unlock(&hdr->lock);
+            return ALLOC_FAIL;
+        }
+        pthread_mutex_consistent(&hdr->lock);
+        return ALLOC_OK;
+    }
+    if(rc != 0) {
+        return ALLOC_FAIL;
+    }
+    pool_mgr->tag_root = hdr->tag_root;
+    pool_mgr->used_nodes = hdr->used_nodes;
+    pool_mgr->pool.alloc_size = hdr->alloc_size;
+    pool_mgr->pool.num_allocs = hdr->num_allocs;
+    pool_mgr->pool.num_gaps = hdr->num_gaps;
     return ALLOC_OK;
 }
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
-                                            size_t size,
-                                            node_pt node) {
-    //printf("_mem_remove_from_gap_ix\n");
-    // find the position of the node in the gap index
-    int found = 0;
-    for(int i = 0; i < pool_mgr->pool.num_gaps; i++) {
-        if(pool_mgr->gap_ix[i].node == node) {
-            found = 1;
+static void _mem_shared_unlock(pool_mgr_pt pool_mgr) {
+    _mem_shared_save(pool_mgr);
+    pthread_mutex_unlock(&pool_mgr->file->lock);
+}
+
+// the counters of the pool_mgr back to the header
+static void _mem_shared_save(pool_mgr_pt pool_mgr) {
+    file_hdr_pt hdr = pool_mgr->file;
+    hdr->tag_root = pool_mgr->tag_root;
+    hdr->used_nodes = pool_mgr->used_nodes;
+    hdr->alloc_size = pool_mgr->pool.alloc_size;
+    hdr->num_allocs = pool_mgr->pool.num_allocs;
+    hdr->num_gaps = pool_mgr->pool.num_gaps;
+}
+
+static unsigned _mem_shared_record_hash(pool_mgr_pt pool_mgr, size_t offset) {
+    return (unsigned) (((uint64_t) (offset / sizeof(size_t)) * 0x9E3779B97F4A7C15ull) >> 32) &
+           (pool_mgr->shared_records_capacity - 1);
+}
+
+// this process's record of the block at offset, made on the first use
+// and pointed into this mapping; the caller sets the size
+static alloc_pt _mem_shared_record(pool_mgr_pt pool_mgr, size_t offset) {
+    if(pool_mgr->shared_records != NULL) {
+        for(shared_record_pt r = pool_mgr->shared_records[_mem_shared_record_hash(pool_mgr, offset)];
+            r != NULL; r = r->next) {
+            if(r->offset == offset) {
+                return &r->alloc_record;
+            }
+        }
+    }
+    // grow the buckets to keep the chains short
+    if(pool_mgr->shared_records_count >= pool_mgr->shared_records_capacity) {
+        unsigned capacity = (pool_mgr->shared_records == NULL) ? MEM_SHARED_RECORDS_INIT_CAPACITY
+                                                               : pool_mgr->shared_records_capacity * 2;
+        shared_record_pt *buckets = (shared_record_pt *) calloc(capacity, sizeof(shared_record_pt));
+        if(buckets == NULL) {
+            return NULL;
         }
-        if(found == 1) {
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i + 1];
+        unsigned oldCapacity = pool_mgr->shared_records_capacity;
+        shared_record_pt *old = pool_mgr->shared_records;
+        pool_mgr->shared_records = buckets;
+        pool_mgr->shared_records_capacity = capacity;
+        for(unsigned i = 0; i < oldCapacity; i++) {
+            while(old[i] != NULL) {
+                shared_record_pt r = old[i];
+                old[i] = r->next;
+                unsigned h = _mem_shared_record_hash(pool_mgr, r->offset);
+                r->next = buckets[h];
+                buckets[h] = r;
+            }
         }
+        free(old);
     }
-    if(found == 0) {
-        //printf("_mem_remove_from_gap_ix fail\n");
-        return ALLOC_FAIL;
+    shared_record_pt r = (shared_record_pt) malloc(sizeof(shared_record_t));
+    if(r == NULL) {
+        return NULL;
     }
-    else {
-        int lastEntry = pool_mgr->pool.num_gaps;
-        pool_mgr->pool.num_gaps--;
-        pool_mgr->gap_ix[lastEntry].size = 0;
-        pool_mgr->gap_ix[lastEntry].node = NULL;
+    unsigned h = _mem_shared_record_hash(pool_mgr, offset);
+    r->alloc_record.mem = pool_mgr->pool.mem + offset + sizeof(tag_hdr_t);
+    r->alloc_record.size = 0;
+    r->offset = offset;
+    r->next = pool_mgr->shared_records[h];
+    pool_mgr->shared_records[h] = r;
+    pool_mgr->shared_records_count++;
+    return &r->alloc_record;
+}
+
+// the block offset of one of this process's records, TAG_NIL for any
+// other pointer
+static size_t _mem_shared_record_offset(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    if(alloc == NULL || pool_mgr->shared_records == NULL) {
+        return TAG_NIL;
+    }
+    size_t offset = ((shared_record_pt) alloc)->offset;
+    for(shared_record_pt r = pool_mgr->shared_records[_mem_shared_record_hash(pool_mgr, offset)];
+        r != NULL; r = r->next) {
+        if(&r->alloc_record == alloc) {
+            return offset;
+        }
+    }
+    return TAG_NIL;
+}
+
+// the block at offset was freed: its record goes
+static void _mem_shared_record_drop(pool_mgr_pt pool_mgr, size_t offset) {
+    if(pool_mgr->shared_records == NULL) {
+        return;
+    }
+    shared_record_pt *link = &pool_mgr->shared_records[_mem_shared_record_hash(pool_mgr, offset)];
+    while(*link != NULL) {
+        if((*link)->offset == offset) {
+            shared_record_pt r = *link;
+            *link = r->next;
+            free(r);
+            pool_mgr->shared_records_count--;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+static void _mem_shared_records_free(pool_mgr_pt pool_mgr) {
+    if(pool_mgr->shared_records == NULL) {
+        return;
+    }
+    for(unsigned i = 0; i < pool_mgr->shared_records_capacity; i++) {
+        while(pool_mgr->shared_records[i] != NULL) {
+            shared_record_pt r = pool_mgr->shared_records[i];
+            pool_mgr->shared_records[i] = r->next;
+            free(r);
+        }
+    }
+    free(pool_mgr->shared_records);
+    pool_mgr->shared_records = NULL;
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* Reserved pools (POOL_RESERVE)         */
+/*                                       */
+/*****************************************/
+// the pool is mapped PROT_NONE, which reserves the address space but
+// commits no memory; the front of it is made read/write as allocations
+// reach into it, a step at a time, up to a high-water mark that never
+// goes down (purged pages stay committed, just not resident)
+
+// make sure [0, end) is committed
+static alloc_status _mem_commit(pool_mgr_pt pool_mgr, size_t end) {
+    if(end <= pool_mgr->committed) {
         return ALLOC_OK;
     }
-    // loop from there to the end of the array:
-    //    pull the entries (i.e. copy over) one position up
-    //    this effectively deletes the chosen node
-    // update metadata (num_gaps)
-    // zero out the element at position num_gaps!
-}
-
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
-    //printf("_mem_sort_gap_ix\n");
-    // the new entry is at the end, so "bubble it up"
-    // loop from num_gaps - 1 until but not including 0:
-    //    if the size of the current entry is less than the previous (u - 1)
-    //    or if the sizes are the same but the current entry points to a
-    //    node with a lower address of pool allocation address (mem)
-    //       swap them (by copying) (remember to use a temporary variable)
-    /*int start = pool_mgr->pool.num_gaps - 1;
-    int point = start;
-    for(int i = 0; i < start; i++) {
-        if(pool_mgr->gap_ix[i].size > pool_mgr->gap_ix[start].size) {
-            printf("%d > %d\n", (int) pool_mgr->gap_ix[i].size, (int) pool_mgr->gap_ix[start].size);
-            point = i;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t limit = (pool_mgr->pool.total_size + page - 1) & ~(page - 1);
+    size_t to = (end + MEM_RESERVE_COMMIT_SIZE - 1) & ~(MEM_RESERVE_COMMIT_SIZE - 1);
+    if(to > limit) {
+        to = limit;
+    }
+    if(mprotect(pool_mgr->pool.mem + pool_mgr->committed, to - pool_mgr->committed,
+                PROT_READ | PROT_WRITE) != 0) {
+        return ALLOC_FAIL;
+    }
+    // what is committed may be resident, up to the end of the pool
+    size_t from = pool_mgr->committed;
+    pool_mgr->committed = to;
+    if(to > pool_mgr->pool.total_size) {
+        to = pool_mgr->pool.total_size;
+    }
+    pool_mgr->pool.resident_size += to - from;
+    return ALLOC_OK;
+}
+
+
+
+/*****************************************/
+/*                                       */
+/* Free by address                       */
+/*                                       */
+/*****************************************/
+// the pool of an address is found in the sorted address ranges of the
+// open pools, by binary search; the block at an offset is found by its
+// boundary tag, or in a node-heap pool by the offset index, a hash of the
+// allocated nodes by offset (built the first time it's needed, then kept
+// up to date with every allocation and free of the pool)
+
+// note: called with the lock of the pool's context held
+static alloc_status _mem_range_add(pool_mgr_pt pool_mgr) {
+    pthread_rwlock_wrlock(&pool_ranges_lock);
+    if(num_pool_ranges == pool_ranges_capacity) {
+        unsigned newCapacity = pool_ranges_capacity ? pool_ranges_capacity * 2
+                                                    : MEM_POOL_RANGES_INIT_CAPACITY;
+        pool_range_pt newRanges = realloc(pool_ranges, sizeof(pool_range_t) * newCapacity);
+        if(newRanges == NULL) {
+            pthread_rwlock_unlock(&pool_ranges_lock);
+            return ALLOC_FAIL;
+        }
+        pool_ranges = newRanges;
+        pool_ranges_capacity = newCapacity;
+    }
+    // pools don't overlap, so the ranges are sorted by start
+    unsigned i = num_pool_ranges;
+    while(i > 0 && pool_ranges[i - 1].start > pool_mgr->pool.mem) {
+        --i;
+    }
+    memmove(&pool_ranges[i + 1], &pool_ranges[i], sizeof(pool_range_t) * (num_pool_ranges - i));
+    pool_ranges[i].start = pool_mgr->pool.mem;
+    pool_ranges[i].end = pool_mgr->pool.mem + pool_mgr->pool.total_size;
+    pool_ranges[i].mgr = pool_mgr;
+    num_pool_ranges++;
+    pthread_rwlock_unlock(&pool_ranges_lock);
+    return ALLOC_OK;
+}
+
+// note: called with the lock of the pool's context held
+static void _mem_range_remove(pool_mgr_pt pool_mgr) {
+    pthread_rwlock_wrlock(&pool_ranges_lock);
+    for(unsigned i = 0; i < num_pool_ranges; i++) {
+        if(pool_ranges[i].mgr == pool_mgr) {
+            memmove(&pool_ranges[i], &pool_ranges[i + 1], sizeof(pool_range_t) * (num_pool_ranges - i - 1));
+            num_pool_ranges--;
+            break;
+        }
+    }
+    // the last pool takes the array with it
+    if(num_pool_ranges == 0) {
+        free(pool_ranges);
+        pool_ranges = NULL;
+        pool_ranges_capacity = 0;
+    }
+    pthread_rwlock_unlock(&pool_ranges_lock);
+}
+
+static pool_mgr_pt _mem_range_find(const char *mem) {
+    pool_mgr_pt pool_mgr = NULL;
+    pthread_rwlock_rdlock(&pool_ranges_lock);
+    // the last range that starts at or below the address
+    unsigned lo = 0;
+    unsigned hi = num_pool_ranges;
+    while(lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if(pool_ranges[mid].start <= mem) {
+            lo = mid + 1;
         }
         else {
-            printf("%d < %d\n", (int) pool_mgr->gap_ix[i].size, (int) pool_mgr->gap_ix[start].size);
-        }
-    }
-    gap_t gap1 = pool_mgr->gap_ix[start];
-    gap_t gap2 = pool_mgr->gap_ix[point];
-    for(int i = point; i < start + 1; i++) {
-        gap2 = pool_mgr->gap_ix[i];
-        pool_mgr->gap_ix[i] = gap1;
-        gap1 = gap2;
-    }*/
-    for(int i = pool_mgr->pool.num_gaps - 1; i > 0; i--) {
-        if(pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i - 1].size) {
-            size_t tempSize = pool_mgr->gap_ix[i].size;
-            node_pt tempNode = pool_mgr->gap_ix[i].node;
-            pool_mgr->gap_ix[i].size = pool_mgr->gap_ix[i - 1].size;
-            pool_mgr->gap_ix[i].node = pool_mgr->gap_ix[i - 1].node;
-            pool_mgr->gap_ix[i - 1].size = tempSize;
-            pool_mgr->gap_ix[i - 1].node = tempNode;
+            hi = mid;
+        }
+    }
+    if(lo > 0 && mem < pool_ranges[lo - 1].end) {
+        pool_mgr = pool_ranges[lo - 1].mgr;
+    }
+    pthread_rwlock_unlock(&pool_ranges_lock);
+    return pool_mgr;
+}
+
+static inline unsigned _mem_offset_hash(pool_mgr_pt pool_mgr, size_t offset) {
+    return (unsigned) (((uint64_t) offset * 0x9e3779b97f4a7c15ULL) >> 32) & (pool_mgr->offset_ix_capacity - 1);
+}
+
+static void _mem_offset_ix_put(pool_mgr_pt pool_mgr, uint32_t node) {
+    mem_off_t offset = pool_mgr->node_heap[node].offset;
+    unsigned i = _mem_offset_hash(pool_mgr, offset);
+    while(pool_mgr->offset_ix[i].node != NODE_NIL) {
+        i = (i + 1) & (pool_mgr->offset_ix_capacity - 1);
+    }
+    pool_mgr->offset_ix[i].offset = offset;
+    pool_mgr->offset_ix[i].node = node;
+    pool_mgr->offset_ix_count++;
+}
+
+// (re)build the index with room for at least count allocations; without
+// the memory for it, the pool is left without an index
+static alloc_status _mem_offset_ix_build(pool_mgr_pt pool_mgr, unsigned count) {
+    unsigned capacity = MEM_OFFSET_IX_INIT_CAPACITY;
+    while(capacity * MEM_OFFSET_IX_FILL_FACTOR <= count) {
+        capacity *= 2;
+    }
+    free(pool_mgr->offset_ix);
+    pool_mgr->offset_ix_count = 0;
+    numa_policy_t saved;
+    _mem_numa_enter(pool_mgr->numa_node, &saved);
+    pool_mgr->offset_ix = (offset_entry_pt) malloc(sizeof(offset_entry_t) * capacity);
+    _mem_numa_leave(&saved);
+    if(pool_mgr->offset_ix == NULL) {
+        pool_mgr->offset_ix_capacity = 0;
+        return ALLOC_FAIL;
+    }
+    pool_mgr->offset_ix_capacity = capacity;
+    for(unsigned i = 0; i < capacity; i++) {
+        pool_mgr->offset_ix[i].node = NODE_NIL;
+    }
+    for(uint32_t node = 0; node < pool_mgr->total_nodes; node++) {
+        if(_node_is_allocated(&pool_mgr->node_heap[node])) {
+            _mem_offset_ix_put(pool_mgr, node);
         }
     }
     return ALLOC_OK;
 }
 
+// note: the node is allocated already
+static void _mem_offset_ix_add(pool_mgr_pt pool_mgr, uint32_t node) {
+    if(pool_mgr->offset_ix == NULL) {
+        return;
+    }
+    if(pool_mgr->offset_ix_count + 1 > pool_mgr->offset_ix_capacity * MEM_OFFSET_IX_FILL_FACTOR) {
+        // the rebuild picks up the node
+        _mem_offset_ix_build(pool_mgr, pool_mgr->offset_ix_count + 1);
+        return;
+    }
+    _mem_offset_ix_put(pool_mgr, node);
+}
+
+// note: the node is still allocated
+static void _mem_offset_ix_remove(pool_mgr_pt pool_mgr, uint32_t node) {
+    if(pool_mgr->offset_ix == NULL) {
+        return;
+    }
+    unsigned mask = pool_mgr->offset_ix_capacity - 1;
+    unsigned i = _mem_offset_hash(pool_mgr, pool_mgr->node_heap[node].offset);
+    while(pool_mgr->offset_ix[i].node != node) {
+        if(pool_mgr->offset_ix[i].node == NODE_NIL) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    // shift back the entries that probed past the hole
+    for(unsigned j = (i + 1) & mask; pool_mgr->offset_ix[j].node != NODE_NIL; j = (j + 1) & mask) {
+        unsigned home = _mem_offset_hash(pool_mgr, pool_mgr->offset_ix[j].offset);
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            pool_mgr->offset_ix[i] = pool_mgr->offset_ix[j];
+            i = j;
+        }
+    }
+    pool_mgr->offset_ix[i].node = NODE_NIL;
+    pool_mgr->offset_ix_count--;
+}
+
+// the allocated node at an offset, NODE_NIL if there is none
+static uint32_t _mem_offset_ix_find(pool_mgr_pt pool_mgr, size_t offset) {
+    if(pool_mgr->offset_ix == NULL &&
+       _mem_offset_ix_build(pool_mgr, pool_mgr->pool.num_allocs) != ALLOC_OK) {
+        return NODE_NIL;
+    }
+    unsigned i = _mem_offset_hash(pool_mgr, offset);
+    while(pool_mgr->offset_ix[i].node != NODE_NIL) {
+        if(pool_mgr->offset_ix[i].offset == offset) {
+            return pool_mgr->offset_ix[i].node;
+        }
+        i = (i + 1) & (pool_mgr->offset_ix_capacity - 1);
+    }
+    return NODE_NIL;
+}
+
+// the record of the block at an offset, NULL if no block starts there
+static inline alloc_pt _mem_alloc_of_offset(pool_mgr_pt pool_mgr, size_t offset) {
+    if(pool_mgr->flags & POOL_BOUNDARY_TAGS) {
+        return _mem_tag_alloc_at(pool_mgr, offset);
+    }
+    uint32_t node = _mem_offset_ix_find(pool_mgr, offset);
+    return (node != NODE_NIL) ? _mem_get_alloc_record(pool_mgr, node) : NULL;
+}
 
+// free the block at an address, with the locking of mem_del_alloc();
+// with known, checked against the size of the block (ALLOC_BAD_SIZE if
+// it isn't, the block freed all the same); with size, only tell the size
+// of the block
+static alloc_status _mem_ptr_block(pool_mgr_pt pool_mgr, void *ptr, size_t known, size_t *size) {
+    if(pool_mgr->flags & MEM_POOL_SHARDED) {
+        pool_mgr_pt shard = _mem_shard_of(pool_mgr, (const char *) ptr);
+        if(shard == NULL) {
+            return ALLOC_FAIL;
+        }
+        pthread_mutex_lock(&shard->lock);
+        alloc_status status = _mem_ptr_block(shard, ptr, known, size);
+        pthread_mutex_unlock(&shard->lock);
+        return status;
+    }
+    char *mem = (char *) ptr;
+    if(mem < pool_mgr->pool.mem || mem >= pool_mgr->pool.mem + pool_mgr->pool.total_size) {
+        return ALLOC_FAIL;
+    }
+    size_t offset = (size_t) (mem - pool_mgr->pool.mem);
+    // other threads queue the record for the owner: a boundary-tag block
+    // has it beside it, the offset index is only the owner's to read
+    if((pool_mgr->flags & POOL_OWNER_THREAD) &&
+       !pthread_equal(pthread_self(), pool_mgr->owner)) {
+        alloc_pt alloc = (pool_mgr->flags & POOL_BOUNDARY_TAGS) ? _mem_tag_alloc_at(pool_mgr, offset) : NULL;
+        if(alloc == NULL) {
+            return ALLOC_FAIL;
+        }
+        if(size != NULL) {
+            *size = alloc->size;
+            return ALLOC_OK;
+        }
+        alloc_status status = (known != 0 && alloc->size != known) ? ALLOC_BAD_SIZE : ALLOC_OK;
+        _mem_push_remote_free(pool_mgr, alloc);
+        return status;
+    }
+    if(pool_mgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_lock(&pool_mgr->lock);
+    }
+    if((pool_mgr->flags & MEM_POOL_SHARED) && _mem_shared_lock(pool_mgr) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+    _mem_write_begin(pool_mgr);
+    alloc_pt alloc = _mem_alloc_of_offset(pool_mgr, offset);
+    alloc_status status = ALLOC_FAIL;
+    if(alloc != NULL && size != NULL) {
+        *size = alloc->size;
+        status = ALLOC_OK;
+    }
+    else if(alloc != NULL) {
+        // a sized free of the wrong size is a bug of the caller's: the
+        // block is found by its address, so it is freed, and reported
+        size_t allocSize = alloc->size;
+        status = _mem_del_alloc(pool_mgr, alloc);
+        if(status == ALLOC_OK && known != 0 && allocSize != known) {
+            status = ALLOC_BAD_SIZE;
+        }
+    }
+    _mem_write_end(pool_mgr);
+    if(pool_mgr->flags & MEM_POOL_SHARED) {
+        _mem_shared_unlock(pool_mgr);
+    }
+    if(pool_mgr->flags & MEM_POOL_LOCKING) {
+        pthread_mutex_unlock(&pool_mgr->lock);
+    }
+    return status;
+}
@@ -6,11 +6,55 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* type declarations */
 
 typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
 
+typedef enum _pool_flags {
+    POOL_DEFAULT        = 0,
+    POOL_BOUNDARY_TAGS  = 1 << 0,   // header/footer tags in the pool, no node heap
+    POOL_OWNER_THREAD   = 1 << 1,   // owned by the opening thread, others may only free
+    POOL_DEFERRED_COALESCING = 1 << 2,  // freed blocks are reused by size, merged in batches
+    POOL_BACKGROUND     = 1 << 3,   // maintained by the background thread (implies deferred)
+    POOL_NUMA_NODE      = 1 << 4,   // pool and metadata placed on opts->numa_node
+    POOL_RESERVE        = 1 << 5,   // address space reserved, memory committed as allocated
+    POOL_SIZE_CLASSES   = 1 << 6,   // block sizes rounded to four classes per power of 2
+    POOL_LOCKED         = 1 << 7    // every call takes the pool's lock, any thread may use it
+} pool_flags;
+
+// POOL_NUMA_NODE: the node of the calling thread
+#define POOL_NUMA_LOCAL (-1)
+
+typedef struct _pool_opts {
+    unsigned flags;                 // pool_flags
+    int numa_node;                  // POOL_NUMA_NODE: a node, or POOL_NUMA_LOCAL
+    size_t granularity;             // block sizes are multiples of it, a power of 2 (0: 1)
+    size_t min_split;               // a smaller remainder of a gap goes with the block (0: none)
+} pool_opts_t, *pool_opts_pt;
+
+typedef struct _maint_opts {
+    unsigned interval_ms;           // between passes (0: default)
+    unsigned budget;                // nodes visited per pass (0: default)
+    unsigned decay_ms;              // how long a gap is free before it's purged (0: default)
+    unsigned lazy;                  // purge with MADV_FREE rather than MADV_DONTNEED
+} maint_opts_t, *maint_opts_pt;
+
+// boundary-tag pools: the bytes a block of a given size takes in the pool
+// (24-byte header, payload rounded up to 8, 8-byte footer)
+#define MEM_TAG_BLOCK_SIZE(size) (32 + (((size) + 7) & ~(size_t) 7))
+
+// the largest granularity of a pool
+#define MEM_MAX_GRANULARITY 4096
+
+// gaps below this size are counted as small by mem_pool_frag()
+#define MEM_FRAG_SMALL_GAP 64
+
 typedef struct _pool {
     char *mem;
     alloc_policy policy;
@@ -18,6 +62,8 @@ typedef struct _pool {
     size_t alloc_size;
     unsigned num_allocs;
     unsigned num_gaps;
+    size_t purged_size;     // bytes of free pages returned to the OS
+    size_t resident_size;   // the rest of total_size
 } pool_t, *pool_pt;
 
 typedef struct _alloc {
@@ -25,16 +71,39 @@ typedef struct _alloc {
     char *mem;
 } alloc_t, *alloc_pt;
 
+// the fragmentation of a pool: internal, the bytes the allocations take
+// beyond those asked for; external, the share of the free bytes outside
+// the largest gap
+typedef struct _pool_frag {
+    size_t requested_size;  // asked for by the allocations
+    size_t alloc_size;      // taken by them (with boundary tags, the tags too)
+    size_t free_size;
+    size_t largest_gap;
+    unsigned num_gaps;
+    unsigned num_small_gaps;    // below MEM_FRAG_SMALL_GAP
+    double internal;        // (alloc_size - requested_size) / alloc_size
+    double external;        // 1 - largest_gap / free_size
+} pool_frag_t, *pool_frag_pt;
+
 typedef struct _pool_segment {
     size_t size;
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+// a pool's slot in the pool store and the generation of the slot, which
+// moves on when the pool is closed (POOL_HANDLE_NONE is never valid)
+typedef uint64_t pool_handle_t;
+#define POOL_HANDLE_NONE ((pool_handle_t) 0)
+
+// an independent pool store, see mem_context_create()
+typedef struct _mem_context mem_context_t, *mem_context_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
     ALLOC_CALLED_AGAIN,
-    ALLOC_NOT_FREED
+    ALLOC_NOT_FREED,
+    ALLOC_BAD_SIZE
 } alloc_status;
 
 /* function declarations */
@@ -45,9 +114,30 @@ mem_init();
 alloc_status
 mem_free();
 
+mem_context_pt
+mem_context_create();
+
+alloc_status
+mem_context_destroy(mem_context_pt ctx);
+
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_opts(size_t size, alloc_policy policy, const pool_opts_t *opts);
+
+pool_pt
+mem_pool_open_in(mem_context_pt ctx, size_t size, alloc_policy policy, const pool_opts_t *opts);
+
+pool_pt
+mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards);
+
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy);
+
+pool_pt
+mem_pool_open_shared(const char *name, size_t size, alloc_policy policy);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
@@ -57,7 +147,85 @@ mem_new_alloc(pool_pt pool, size_t size);
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_free_ptr(void *ptr);
+
+size_t
+mem_ptr_size(void *ptr);
+
+void *
+mem_alloc(pool_pt pool, size_t size);
+
+alloc_status
+mem_release(pool_pt pool, void *ptr);
+
+alloc_status
+mem_release_sized(pool_pt pool, void *ptr, size_t size);
+
+alloc_status
+mem_maintenance_start(const maint_opts_t *opts);
+
+alloc_status
+mem_maintenance_wake();
+
+alloc_status
+mem_maintenance_stop();
+
+// pthread_atfork() handlers: prepare takes every lock of the library,
+// parent releases them, child releases them and forgets the maintenance
+// thread, which the child doesn't have
+void
+mem_fork_prepare();
+
+void
+mem_fork_parent();
+
+void
+mem_fork_child();
+
+// the segments are copied without a lock while no writer tears the walk;
+// after MEM_INSPECT_RETRIES torn walks a pool with a lock (POOL_LOCKED,
+// POOL_BACKGROUND, a shard) is walked under it, so the reader blocks until
+// the writer inside is done and holds off the others; a pool without one
+// is walked again for as long as a writer keeps changing it
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+alloc_status
+mem_pool_stats(pool_pt pool, pool_t *stats);
+
+alloc_status
+mem_pool_frag(pool_pt pool, pool_frag_t *frag);
+
+int
+mem_pool_numa_node(pool_pt pool);
+
+alloc_status
+mem_pool_sync(pool_pt pool);
+
+alloc_status
+mem_pool_set_root(pool_pt pool, alloc_pt alloc);
+
+alloc_pt
+mem_pool_get_root(pool_pt pool);
+
+size_t
+mem_pool_offset(pool_pt pool, alloc_pt alloc);
+
+alloc_pt
+mem_pool_alloc_at(pool_pt pool, size_t offset);
+
+pool_handle_t
+mem_pool_handle(pool_pt pool);
+
+pool_pt
+mem_pool_from_handle(pool_handle_t handle);
+
+pool_pt
+mem_pool_from_handle_in(mem_context_pt ctx, pool_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
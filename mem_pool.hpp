@@ -0,0 +1,269 @@
+/*
+ * C++17 adapters over memory pools: a std::pmr::memory_resource and a
+ * standard allocator, so that containers allocate from a pool, and a
+ * typed object pool on slabs from a pool.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_HPP
+#define DENVER_OS_PA_C_MEM_POOL_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mem_pool.h"
+
+namespace mem_pool_detail {
+
+// the alignment of every block of a pool whose blocks all have sizes in
+// multiples of it, with or without boundary tags
+constexpr std::size_t block_alignment = alignof(void *);
+
+inline std::size_t round_up(std::size_t size, std::size_t alignment) noexcept {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// the size of the block for bytes at an alignment, 0 if it overflows
+inline std::size_t block_size(std::size_t bytes, std::size_t alignment) noexcept {
+    std::size_t size = round_up(bytes == 0 ? 1 : bytes, block_alignment);
+    std::size_t padded = (alignment > block_alignment) ? size + alignment : size;
+    return (size < bytes || padded < size) ? 0 : padded;
+}
+
+// a block of the pool or, over-aligned, inside a padded one, with the
+// address of the block right before the one returned
+inline void *allocate(pool_pt pool, std::size_t bytes, std::size_t alignment) {
+    std::size_t padded = block_size(bytes, alignment);
+    if (padded == 0) {
+        throw std::bad_alloc();
+    }
+    char *block = static_cast<char *>(mem_alloc(pool, padded));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    if (alignment <= block_alignment) {
+        // the pool has blocks of other sizes
+        if (reinterpret_cast<std::uintptr_t>(block) % alignment != 0) {
+            mem_release(pool, block);
+            throw std::bad_alloc();
+        }
+        return block;
+    }
+    std::uintptr_t aligned = round_up(reinterpret_cast<std::uintptr_t>(block) + sizeof(void *), alignment);
+    reinterpret_cast<void **>(aligned)[-1] = block;
+    return reinterpret_cast<void *>(aligned);
+}
+
+// the pool finds the block by its address, and checks that it is of the
+// size it was allocated with: another size or alignment than allocated is
+// a bug of the caller's, asserted in debug builds; the block is freed all
+// the same, by its address alone if the size is no block size at all
+inline void deallocate(pool_pt pool, void *ptr, std::size_t bytes, std::size_t alignment) noexcept {
+    void *block = (alignment > block_alignment) ? static_cast<void **>(ptr)[-1] : ptr;
+    alloc_status status = mem_release_sized(pool, block, block_size(bytes, alignment));
+    assert(status == ALLOC_OK && "deallocated with another size or alignment than allocated");
+    if (status == ALLOC_FAIL) {
+        status = mem_release(pool, block);
+    }
+    (void) status;
+}
+
+} // namespace mem_pool_detail
+
+
+// A memory resource over a pool, which it doesn't own: the pool must stay
+// open while anything allocated from the resource is alive. Calls go
+// straight to the pool, so the resource is as thread-safe as the pool is.
+// Sizes are rounded up to 8 bytes, and an alignment over 8 takes a padded
+// block; blocks allocated from the pool by other means must keep to
+// multiples of 8 too. Throws std::bad_alloc when the pool is full.
+class mem_pool_resource : public std::pmr::memory_resource {
+public:
+    explicit mem_pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return mem_pool_detail::allocate(pool_, bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        mem_pool_detail::deallocate(pool_, ptr, bytes, alignment);
+    }
+
+    // resources over the same pool free each other's blocks
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const mem_pool_resource *resource = dynamic_cast<const mem_pool_resource *>(&other);
+        return resource != nullptr && resource->pool_ == pool_;
+    }
+
+private:
+    pool_pt pool_;
+};
+
+
+// An allocator for the standard containers over a pool, which it doesn't
+// own. The pool goes with the container when it is copied, moved or
+// swapped, and allocators over the same pool compare equal.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit PoolAllocator(pool_pt pool) noexcept : pool_(pool) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept : pool_(other.pool()) {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(mem_pool_detail::allocate(pool_, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        mem_pool_detail::deallocate(pool_, ptr, n * sizeof(T), alignof(T));
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+private:
+    pool_pt pool_;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept {
+    return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept {
+    return a.pool() != b.pool();
+}
+
+
+// Objects of one type in slabs of SlotsPerSlab slots from a pool, which it
+// doesn't own. The slot size and alignment are those of T, known at
+// compile time, and free slots are linked through themselves, so an
+// allocation pops the free list and a deallocation pushes it; the pool is
+// only called for a new slab when the list is empty. Slabs go back to the
+// pool when the object pool is destroyed, by which time its objects must
+// have been. Not thread-safe.
+template <typename T, std::size_t SlotsPerSlab = 64>
+class ObjectPool {
+    static_assert(SlotsPerSlab > 0, "a slab has at least one slot");
+
+public:
+    explicit ObjectPool(pool_pt pool) noexcept : pool_(pool) {}
+
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    ~ObjectPool() {
+        while (slabs_ != nullptr) {
+            Slab *next = slabs_->next;
+            mem_pool_detail::deallocate(pool_, slabs_, sizeof(Slab), alignof(Slab));
+            slabs_ = next;
+        }
+    }
+
+    // an uninitialized slot, for a T
+    void *allocate() {
+        if (free_ == nullptr) {
+            grow();
+        }
+        Slot *slot = free_;
+        free_ = slot->next;
+        return slot;
+    }
+
+    void deallocate(void *ptr) noexcept {
+        Slot *slot = static_cast<Slot *>(ptr);
+        slot->next = free_;
+        free_ = slot;
+    }
+
+    template <typename... Args>
+    T *create(Args &&... args) {
+        void *slot = allocate();
+        try {
+            return ::new (slot) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(slot);
+            throw;
+        }
+    }
+
+    void destroy(T *ptr) noexcept {
+        ptr->~T();
+        deallocate(ptr);
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+    std::size_t num_slabs() const noexcept { return num_slabs_; }
+
+private:
+    union Slot {
+        Slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Slab {
+        Slot slots[SlotsPerSlab];
+        Slab *next;
+    };
+
+    // a slab from the pool, its slots on the free list in address order
+    void grow() {
+        Slab *slab = static_cast<Slab *>(mem_pool_detail::allocate(pool_, sizeof(Slab), alignof(Slab)));
+        slab->next = slabs_;
+        slabs_ = slab;
+        ++num_slabs_;
+        for (std::size_t i = SlotsPerSlab; i-- > 0;) {
+            slab->slots[i].next = free_;
+            free_ = &slab->slots[i];
+        }
+    }
+
+    pool_pt pool_;
+    Slot *free_ = nullptr;
+    Slab *slabs_ = nullptr;
+    std::size_t num_slabs_ = 0;
+};
+
+// destroys an object of an object pool into the pool
+template <typename T, std::size_t SlotsPerSlab = 64>
+class PooledDeleter {
+public:
+    explicit PooledDeleter(ObjectPool<T, SlotsPerSlab> *pool) noexcept : pool_(pool) {}
+
+    void operator()(T *ptr) const noexcept { pool_->destroy(ptr); }
+
+private:
+    ObjectPool<T, SlotsPerSlab> *pool_;
+};
+
+template <typename T, std::size_t SlotsPerSlab = 64>
+using pooled_ptr = std::unique_ptr<T, PooledDeleter<T, SlotsPerSlab>>;
+
+// an object constructed in an object pool, destroyed into it with the
+// pointer
+template <typename T, std::size_t SlotsPerSlab, typename... Args>
+pooled_ptr<T, SlotsPerSlab> make_pooled(ObjectPool<T, SlotsPerSlab> &pool, Args &&... args) {
+    return pooled_ptr<T, SlotsPerSlab>(pool.create(std::forward<Args>(args)...),
+                                       PooledDeleter<T, SlotsPerSlab>(&pool));
+}
+
+#endif //DENVER_OS_PA_C_MEM_POOL_HPP
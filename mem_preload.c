@@ -0,0 +1,419 @@
+/*
+ * LD_PRELOAD library: malloc, free and friends on memory pools.
+ *
+ *   LD_PRELOAD=./libmem_pool_preload.so <command>
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h> // for memcpy(), memset()
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h> // for sysconf()
+#include <sys/mman.h>
+
+#include "mem_pool.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+
+// every thread allocates from pools of its own, reserved rather than
+// committed, up to this many; past them, and for large or page-aligned
+// blocks, the memory is mapped for each block
+static const size_t     MEM_PRELOAD_POOL_SIZE           = 64 << 20;
+#define                 MEM_PRELOAD_THREAD_POOLS        8
+static const size_t     MEM_PRELOAD_MMAP_THRESHOLD      = 128 << 10;
+
+// the pools of exited threads kept for new ones, past them a pool is
+// left to the blocks still in it
+#define                 MEM_PRELOAD_FREE_POOLS          64
+
+// malloc's alignment: pool blocks are rounded up to it, so they all
+// start at a multiple of it
+#define                 MEM_PRELOAD_ALIGN               16
+
+// a gap left under this by a block goes with it, rather than linger as
+// a gap nothing fits in
+#define                 MEM_PRELOAD_MIN_SPLIT           64
+
+#define                 MEM_PRELOAD_MAP_MAGIC           0x50414d4d454d4c50ULL   // "PLMEMMAP"
+#define                 MEM_PRELOAD_ALIGN_MAGIC         0x4e4c414d454d4c50ULL   // "PLMEMALN"
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+
+// right before a mapped block
+typedef struct _map_hdr {
+    void *base;             // the mapping
+    size_t length;
+    size_t size;            // the usable bytes from the block on
+    uint64_t magic;
+} map_hdr_t, *map_hdr_pt;
+
+// right before an over-aligned block inside a padded pool block
+typedef struct _align_hdr {
+    void *block;            // the pool block
+    uint64_t magic;
+} align_hdr_t, *align_hdr_pt;
+
+
+
+/***************************/
+/*                         */
+/* Static global variables */
+/*                         */
+/***************************/
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+
+// set in a thread with pools, for the destructor to hand them on
+static pthread_key_t preload_key;
+
+// the pools of exited threads
+static pool_pt free_pools[MEM_PRELOAD_FREE_POOLS];
+static unsigned num_free_pools = 0;
+static pthread_mutex_t free_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// initial-exec: a dynamic TLS block would be allocated with malloc
+static _Thread_local pool_pt thread_pools[MEM_PRELOAD_THREAD_POOLS]
+        __attribute__((tls_model("initial-exec")));
+static _Thread_local unsigned num_thread_pools
+        __attribute__((tls_model("initial-exec")));
+
+
+
+/********************************************/
+/*                                          */
+/* Forward declarations of static functions */
+/*                                          */
+/********************************************/
+static void _preload_register(void) __attribute__((constructor));
+static void _preload_init(void);
+static void _preload_thread_exit(void *arg);
+static void _preload_fork_prepare(void);
+static void _preload_fork_parent(void);
+static void _preload_fork_child(void);
+static pool_pt _preload_new_pool(void);
+static void *_preload_alloc(size_t size, size_t alignment);
+static void *_preload_pool_alloc(size_t size);
+static pool_pt _preload_thread_pool(void *ptr);
+static void *_preload_aligned_block(void *ptr);
+static void *_preload_map(size_t size, size_t alignment);
+static map_hdr_pt _preload_map_hdr(void *ptr);
+static size_t _preload_size(void *ptr);
+
+
+
+/****************************************/
+/*                                      */
+/* Definitions of user-facing functions */
+/*                                      */
+/****************************************/
+void *malloc(size_t size) {
+    return _preload_alloc(size, MEM_PRELOAD_ALIGN);
+}
+
+void free(void *ptr) {
+    if(ptr == NULL) {
+        return;
+    }
+    // a pool block, an over-aligned one inside a pool block, or a mapped
+    // one; the thread's own blocks go back to its pool without the lookup
+    // of mem_free_ptr, which takes a lock all threads share
+    pool_pt pool = _preload_thread_pool(ptr);
+    if(pool != NULL && mem_release(pool, ptr) == ALLOC_OK) {
+        return;
+    }
+    if(pool == NULL && mem_free_ptr(ptr) == ALLOC_OK) {
+        return;
+    }
+    void *block = _preload_aligned_block(ptr);
+    if(block != NULL) {
+        if(pool != NULL) {
+            mem_release(pool, block);
+        }
+        else {
+            mem_free_ptr(block);
+        }
+        return;
+    }
+    map_hdr_pt hdr = _preload_map_hdr(ptr);
+    if(hdr != NULL) {
+        munmap(hdr->base, hdr->length);
+    }
+}
+
+void *calloc(size_t num, size_t size) {
+    if(size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = malloc(num * size);
+    // a fresh mapping is zeroed already, pool memory may have been used
+    if(ptr != NULL && mem_ptr_size(ptr) != 0) {
+        memset(ptr, 0, num * size);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if(ptr == NULL) {
+        return malloc(size);
+    }
+    if(size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    // blocks don't grow in place: a larger one is allocated and copied
+    size_t oldSize = _preload_size(ptr);
+    if(size <= oldSize) {
+        return ptr;
+    }
+    void *newPtr = malloc(size);
+    if(newPtr == NULL) {
+        return NULL;
+    }
+    memcpy(newPtr, ptr, oldSize);
+    free(ptr);
+    return newPtr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if(alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = _preload_alloc(size, alignment);
+    if(ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return _preload_alloc(size, alignment);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return _preload_alloc(size, (size_t) sysconf(_SC_PAGESIZE));
+}
+
+void *pvalloc(size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return _preload_alloc((size + page - 1) & ~(page - 1), page);
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return (ptr != NULL) ? _preload_size(ptr) : 0;
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// pthread_atfork() may allocate, so it isn't called from malloc
+static void _preload_register(void) {
+    pthread_atfork(_preload_fork_prepare, _preload_fork_parent, _preload_fork_child);
+}
+
+static void _preload_init(void) {
+    mem_init();
+    pthread_key_create(&preload_key, _preload_thread_exit);
+}
+
+// the pools of an exiting thread go to the free list
+static void _preload_thread_exit(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&free_pools_lock);
+    while(num_thread_pools > 0 && num_free_pools < MEM_PRELOAD_FREE_POOLS) {
+        free_pools[num_free_pools++] = thread_pools[--num_thread_pools];
+    }
+    pthread_mutex_unlock(&free_pools_lock);
+    num_thread_pools = 0;
+}
+
+// the free list's lock, then the library's, so the child has none taken
+static void _preload_fork_prepare(void) {
+    pthread_mutex_lock(&free_pools_lock);
+    mem_fork_prepare();
+}
+
+static void _preload_fork_parent(void) {
+    mem_fork_parent();
+    pthread_mutex_unlock(&free_pools_lock);
+}
+
+static void _preload_fork_child(void) {
+    mem_fork_child();
+    pthread_mutex_unlock(&free_pools_lock);
+}
+
+// a pool from the free list, or a new one
+static pool_pt _preload_new_pool(void) {
+    pool_pt pool = NULL;
+    pthread_mutex_lock(&free_pools_lock);
+    if(num_free_pools > 0) {
+        pool = free_pools[--num_free_pools];
+    }
+    pthread_mutex_unlock(&free_pools_lock);
+    if(pool == NULL) {
+        // POOL_LOCKED: any thread frees, and the pool may change hands
+        pool_opts_t opts = { POOL_LOCKED | POOL_RESERVE, 0, MEM_PRELOAD_ALIGN, MEM_PRELOAD_MIN_SPLIT };
+        pool = mem_pool_open_opts(MEM_PRELOAD_POOL_SIZE, BEST_FIT, &opts);
+    }
+    return pool;
+}
+
+static void *_preload_alloc(size_t size, size_t alignment) {
+    pthread_once(&preload_once, _preload_init);
+    // round up, and give malloc(0) a block of its own
+    size_t rounded = (size + MEM_PRELOAD_ALIGN - 1) & ~(size_t) (MEM_PRELOAD_ALIGN - 1);
+    if(rounded < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if(rounded == 0) {
+        rounded = MEM_PRELOAD_ALIGN;
+    }
+    // an over-aligned block is padded to be aligned inside, with room
+    // for its header; large and page-aligned blocks are mapped
+    size_t padded = (alignment > MEM_PRELOAD_ALIGN) ? rounded + alignment : rounded;
+    if(padded < rounded || padded >= MEM_PRELOAD_MMAP_THRESHOLD ||
+       alignment >= (size_t) sysconf(_SC_PAGESIZE)) {
+        return _preload_map(size, alignment);
+    }
+    char *block = _preload_pool_alloc(padded);
+    if(block == NULL) {
+        return _preload_map(size, alignment);
+    }
+    if(alignment <= MEM_PRELOAD_ALIGN) {
+        return block;
+    }
+    uintptr_t aligned = ((uintptr_t) block + sizeof(align_hdr_t) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    align_hdr_pt hdr = (align_hdr_pt) aligned - 1;
+    hdr->block = block;
+    hdr->magic = MEM_PRELOAD_ALIGN_MAGIC;
+    return (void *) aligned;
+}
+
+// a block from the thread's pools, newest first, then from a new one
+static void *_preload_pool_alloc(size_t size) {
+    for(unsigned i = num_thread_pools; i-- > 0;) {
+        void *ptr = mem_alloc(thread_pools[i], size);
+        if(ptr != NULL) {
+            return ptr;
+        }
+    }
+    if(num_thread_pools < MEM_PRELOAD_THREAD_POOLS) {
+        pool_pt pool = _preload_new_pool();
+        if(pool != NULL) {
+            thread_pools[num_thread_pools++] = pool;
+            // for the destructor, which only runs for a value that isn't NULL
+            pthread_setspecific(preload_key, thread_pools);
+            return mem_alloc(pool, size);
+        }
+    }
+    return NULL;
+}
+
+// the thread's pool the block is in, NULL if it is in none of them
+static pool_pt _preload_thread_pool(void *ptr) {
+    for(unsigned i = num_thread_pools; i-- > 0;) {
+        pool_pt pool = thread_pools[i];
+        if((char *) ptr >= pool->mem && (char *) ptr < pool->mem + pool->total_size) {
+            return pool;
+        }
+    }
+    return NULL;
+}
+
+// the pool block an over-aligned block is in, NULL if it isn't one
+static void *_preload_aligned_block(void *ptr) {
+    if(((uintptr_t) ptr & (MEM_PRELOAD_ALIGN - 1)) != 0) {
+        return NULL;
+    }
+    align_hdr_pt hdr = (align_hdr_pt) ptr - 1;
+    // only called for blocks that don't start a pool block: the header
+    // is in the pool block, or in the mapping of a mapped one
+    if(hdr->magic != MEM_PRELOAD_ALIGN_MAGIC) {
+        return NULL;
+    }
+    char *block = hdr->block;
+    size_t size = mem_ptr_size(block);
+    if(size == 0 || (char *) ptr <= block || (char *) ptr >= block + size) {
+        return NULL;
+    }
+    return block;
+}
+
+// a mapping for a single block, the header right before the block
+static void *_preload_map(size_t size, size_t alignment) {
+    if(alignment < MEM_PRELOAD_ALIGN) {
+        alignment = MEM_PRELOAD_ALIGN;
+    }
+    size_t length = sizeof(map_hdr_t) + alignment + size;
+    if(length < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    uintptr_t block = ((uintptr_t) base + sizeof(map_hdr_t) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    map_hdr_pt hdr = (map_hdr_pt) block - 1;
+    hdr->base = base;
+    hdr->length = length;
+    hdr->size = (size_t) (base + length - (char *) block);
+    hdr->magic = MEM_PRELOAD_MAP_MAGIC;
+    return (void *) block;
+}
+
+// the header of a mapped block, NULL if the block isn't one
+static map_hdr_pt _preload_map_hdr(void *ptr) {
+    if(((uintptr_t) ptr & (MEM_PRELOAD_ALIGN - 1)) != 0) {
+        return NULL;
+    }
+    map_hdr_pt hdr = (map_hdr_pt) ptr - 1;
+    // only called for blocks not in a pool, whose header is mapped
+    if(hdr->magic != MEM_PRELOAD_MAP_MAGIC || (void *) hdr < hdr->base) {
+        return NULL;
+    }
+    return hdr;
+}
+
+static size_t _preload_size(void *ptr) {
+    size_t size = mem_ptr_size(ptr);
+    if(size != 0) {
+        return size;
+    }
+    char *block = _preload_aligned_block(ptr);
+    if(block != NULL) {
+        return (size_t) (block + mem_ptr_size(block) - (char *) ptr);
+    }
+    map_hdr_pt hdr = _preload_map_hdr(ptr);
+    return (hdr != NULL) ? hdr->size : 0;
+}
@@ -8,6 +8,13 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <threads.h> // for thrd_sleep()
+#include <unistd.h> // for fork()
+#include <signal.h> // for SIGABRT
+#include <sys/wait.h>
+#include <sys/mman.h> // for shm_unlink()
 
 #include "cmocka.h"
 #include "mem_pool.h"
@@ -93,15 +100,19 @@ static void check_metadata(pool_pt pool,
     assert_non_null(segs);
     assert_int_not_equal(size, 0);
 
+    // the counters of a sharded pool are the shards'
+    pool_t stats;
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+
 #ifdef INSPECT_POOL
     for (unsigned u = 0; u < size; u ++)
         printf("%10lu - %s\n", (unsigned long) segs[u].size, (segs[u].allocated) ? "alloc" : "gap");
 
     printf("%10s = %lu(%lu),\n%10s = %lu(%lu),\n%10s = %u(%u),\n%10s = %u(%u)\n",
-           (char *) "total_size", pool->total_size, total_size,
-           (char *) "alloc_size", pool->alloc_size, alloc_size,
-           (char *) "num_allocs", pool->num_allocs, num_allocs,
-           (char *) "num_gaps",   pool->num_gaps,   num_gaps);
+           (char *) "total_size", stats.total_size, total_size,
+           (char *) "alloc_size", stats.alloc_size, alloc_size,
+           (char *) "num_allocs", stats.num_allocs, num_allocs,
+           (char *) "num_gaps",   stats.num_gaps,   num_gaps);
 #endif
 
     if (segs) free(segs);
@@ -109,10 +120,10 @@ static void check_metadata(pool_pt pool,
     assert_non_null(pool);
     assert_non_null(pool->mem);
     assert_int_equal(pool->policy, policy);
-    assert_in_range(pool->total_size, total_size, total_size);
-    assert_in_range(pool->alloc_size, alloc_size, alloc_size);
-    assert_true(pool->num_allocs == num_allocs);
-    assert_true(pool->num_gaps == num_gaps);
+    assert_in_range(stats.total_size, total_size, total_size);
+    assert_in_range(stats.alloc_size, alloc_size, alloc_size);
+    assert_true(stats.num_allocs == num_allocs);
+    assert_true(stats.num_gaps == num_gaps);
 
 #ifdef INSPECT_POOL
     printf("\n\n");
@@ -190,6 +201,106 @@ static void test_pool_smoketest(void **state) {
     }
 }
 
+static void test_pool_store_handles(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("A closed pool's slot is reused, and its handle goes stale\n");
+    pool_pt keep = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(keep);
+    pool_handle_t keepHandle = mem_pool_handle(keep);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    pool_handle_t handle = mem_pool_handle(pool);
+    assert_true(handle != POOL_HANDLE_NONE);
+    assert_true(handle != keepHandle);
+    assert_ptr_equal(mem_pool_from_handle(handle), pool);
+
+    for (int i = 0; i < 10000; i++) {
+        status = mem_pool_close(pool);
+        assert_int_equal(status, ALLOC_OK);
+        assert_null(mem_pool_from_handle(handle));
+
+        pool = mem_pool_open(POOL_SIZE, (i % 2) ? FIRST_FIT : BEST_FIT);
+        assert_non_null(pool);
+        pool_handle_t newHandle = mem_pool_handle(pool);
+        // the same slot, a new generation
+        assert_int_equal(newHandle & UINT32_MAX, handle & UINT32_MAX);
+        assert_true(newHandle != handle);
+        assert_ptr_equal(mem_pool_from_handle(newHandle), pool);
+        handle = newHandle;
+    }
+    assert_ptr_equal(mem_pool_from_handle(keepHandle), keep);
+    assert_null(mem_pool_from_handle(POOL_HANDLE_NONE));
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(keep);
+    assert_int_equal(status, ALLOC_OK);
+    assert_null(mem_pool_from_handle(keepHandle));
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+static void test_pool_contexts(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    INFO("Contexts have their own pool stores, apart from mem_init's\n");
+    mem_context_pt ctx1 = mem_context_create();
+    mem_context_pt ctx2 = mem_context_create();
+    assert_non_null(ctx1);
+    assert_non_null(ctx2);
+    // the default context isn't initialized
+    assert_null(mem_pool_open(POOL_SIZE, FIRST_FIT));
+
+    pool_opts_t opts = { POOL_BOUNDARY_TAGS };
+    pool_pt pool1 = mem_pool_open_in(ctx1, POOL_SIZE, FIRST_FIT, NULL);
+    pool_pt pool2 = mem_pool_open_in(ctx1, POOL_SIZE, BEST_FIT, &opts);
+    pool_pt pool3 = mem_pool_open_in(ctx2, POOL_SIZE, BEST_FIT, NULL);
+    assert_non_null(pool1);
+    assert_non_null(pool2);
+    assert_non_null(pool3);
+    assert_non_null(mem_new_alloc(pool1, 100));
+    assert_non_null(mem_new_alloc(pool2, 100));
+    alloc_pt alloc = mem_new_alloc(pool3, 100);
+    assert_non_null(alloc);
+
+    // a handle is looked up in the context of its pool
+    pool_handle_t handle1 = mem_pool_handle(pool1);
+    pool_handle_t handle3 = mem_pool_handle(pool3);
+    assert_ptr_equal(mem_pool_from_handle_in(ctx1, handle1), pool1);
+    assert_ptr_equal(mem_pool_from_handle_in(ctx2, handle3), pool3);
+    assert_null(mem_pool_from_handle(handle1));
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    // destroyed with its pools, allocations and all
+    status = mem_context_destroy(ctx1);
+    assert_int_equal(status, ALLOC_OK);
+
+    // the others are untouched
+    assert_int_equal(pool3->num_allocs, 1);
+    assert_int_equal(mem_del_alloc(pool3, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool3), ALLOC_OK);
+    assert_null(mem_pool_from_handle_in(ctx2, handle3));
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_context_destroy(ctx2);
+    assert_int_equal(status, ALLOC_OK);
+}
+
 static void test_pool_nonempty(void **state) {
     (void) state; /* unused */
 
@@ -230,6 +341,31 @@ static void test_pool_nonempty(void **state) {
     status = mem_pool_close(pool);
     assert_int_equal(status, ALLOC_OK);
 
+    INFO("Leaving a pool open past mem_free\n");
+    pool = mem_pool_open(pool_size, POOL_POLICY);
+    assert_non_null(pool);
+    alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    char *mem = alloc->mem;
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    // the pool is on its own, apart from the next pool store
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool_pt other = mem_pool_open(pool_size, POOL_POLICY);
+    assert_non_null(other);
+    pool_handle_t handle = mem_pool_handle(other);
+    assert_int_equal(mem_pool_handle(pool), POOL_HANDLE_NONE);
+    assert_int_equal(mem_free_ptr(mem), ALLOC_FAIL);
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+    assert_ptr_equal(mem_pool_from_handle(handle), other);
+    status = mem_pool_close(other);
+    assert_int_equal(status, ALLOC_OK);
+
     status = mem_free();
     assert_int_equal(status, ALLOC_OK);
 }
@@ -2316,9 +2452,1622 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
+/***          5. POOL MODES              ***/
+/*******************************************/
+
+static void test_pool_boundary_tags(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Boundary-tag pools carry their metadata in the pool, so the
+     * segments are whole blocks, tags included:
+     *
+     * 1. Allocate 100, 1000, 10, 2000. Deallocate the 100 and the 10.
+     * 2. Allocate 5. FIRST_FIT splits the 100's block (first),
+     *    BEST_FIT takes all of the 10's block (smallest, too small to split).
+     * 3. Deallocating the rest coalesces back into one gap.
+     * 4. A block freed twice is refused the second time, whether it was
+     *    merged into the gap before it or the gap after it took it.
+     */
+
+    const pool_opts_t opts = { POOL_BOUNDARY_TAGS };
+    const size_t b100 = MEM_TAG_BLOCK_SIZE(100);
+    const size_t b1000 = MEM_TAG_BLOCK_SIZE(1000);
+    const size_t b10 = MEM_TAG_BLOCK_SIZE(10);
+    const size_t b2000 = MEM_TAG_BLOCK_SIZE(2000);
+    const size_t b5 = MEM_TAG_BLOCK_SIZE(5);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (int i = 0; i < 2; i++) {
+        alloc_policy policy = i ? BEST_FIT : FIRST_FIT;
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+        const size_t rest = pool->total_size - b100 - b1000 - b10 - b2000;
+
+        alloc_pt alloc0 = mem_new_alloc(pool, 100);
+        alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+        alloc_pt alloc2 = mem_new_alloc(pool, 10);
+        alloc_pt alloc3 = mem_new_alloc(pool, 2000);
+        assert_non_null(alloc0);
+        assert_non_null(alloc1);
+        assert_non_null(alloc2);
+        assert_non_null(alloc3);
+        assert_int_equal(alloc0->size, 100);
+        assert_true(alloc1->mem == alloc0->mem + b100);
+
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+        pool_segment_t exp0[5] =
+                {
+                        {b100, 0},
+                        {b1000, 1},
+                        {b10, 0},
+                        {b2000, 1},
+                        {rest, 0}
+                };
+        check_pool(pool, exp0);
+        check_metadata(pool, policy, POOL_SIZE, 3000, 2, 3);
+
+        alloc_pt alloc4 = mem_new_alloc(pool, 5);
+        assert_non_null(alloc4);
+        if (policy == FIRST_FIT) {
+            pool_segment_t exp1[6] =
+                    {
+                            {b5, 1},
+                            {b100 - b5, 0},
+                            {b1000, 1},
+                            {b10, 0},
+                            {b2000, 1},
+                            {rest, 0}
+                    };
+            check_pool(pool, exp1);
+        }
+        else {
+            pool_segment_t exp1[5] =
+                    {
+                            {b100, 0},
+                            {b1000, 1},
+                            {b10, 1},
+                            {b2000, 1},
+                            {rest, 0}
+                    };
+            check_pool(pool, exp1);
+        }
+
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+        pool_segment_t exp2[1] =
+                {
+                        {pool->total_size, 0}
+                };
+        check_pool(pool, exp2);
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+
+        alloc_pt alloc5 = mem_new_alloc(pool, 100);
+        alloc_pt alloc6 = mem_new_alloc(pool, 100);
+        alloc_pt alloc7 = mem_new_alloc(pool, 100);
+        alloc_pt alloc8 = mem_new_alloc(pool, 100);
+        assert_non_null(alloc5);
+        assert_non_null(alloc6);
+        assert_non_null(alloc7);
+        assert_non_null(alloc8);
+        assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_FAIL);
+        assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_FAIL);
+        assert_int_equal(mem_del_alloc(pool, alloc8), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc8), ALLOC_FAIL);
+
+        pool_segment_t exp3[3] =
+                {
+                        {2 * b100, 0},
+                        {b100, 1},
+                        {pool->total_size - 3 * b100, 0}
+                };
+        check_pool(pool, exp3);
+        check_metadata(pool, policy, POOL_SIZE, 100, 1, 2);
+
+        assert_int_equal(mem_del_alloc(pool, alloc7), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc7), ALLOC_FAIL);
+        check_pool(pool, exp2);
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_tag_gap_order(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Boundary-tag gaps whose sizes rise with their address, freed front
+     * to back, and taken again from the largest down: each allocation
+     * fits exactly one gap, which both policies find however the gaps
+     * were ordered when they were indexed.
+     */
+
+    const unsigned num_blocks = 4000;
+    const size_t pool_size = 40000000;
+    const pool_opts_t opts = { POOL_BOUNDARY_TAGS };
+    alloc_pt *allocs = calloc(num_blocks, sizeof(alloc_pt));
+    char **mems = calloc(num_blocks, sizeof(char *));
+    assert_non_null(allocs);
+    assert_non_null(mems);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_opts(pool_size, policy, &opts);
+        assert_non_null(pool);
+
+        for (unsigned i = 0; i < num_blocks; ++i) {
+            allocs[i] = mem_new_alloc(pool, 8 + 8 * (i / 2));
+            assert_non_null(allocs[i]);
+            mems[i] = allocs[i]->mem;
+        }
+        for (unsigned i = 0; i < num_blocks; i += 2) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+        assert_int_equal(pool->num_gaps, num_blocks / 2 + 1);
+        for (unsigned i = num_blocks; i > 0; i -= 2) {
+            allocs[i - 2] = mem_new_alloc(pool, 8 * ((i - 2) / 2) + 1);
+            assert_non_null(allocs[i - 2]);
+            assert_ptr_equal(allocs[i - 2]->mem, mems[i - 2]);
+        }
+        assert_int_equal(pool->num_gaps, 1);
+
+        for (unsigned i = 0; i < num_blocks; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+        check_metadata(pool, policy, pool_size, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    free(allocs);
+    free(mems);
+}
+
+
+static void test_pool_placement_model(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Random allocations and deallocations, each allocation checked
+     * against a naive model of the policy over the segments before it:
+     *
+     *   FIRST_FIT takes the lowest gap that fits
+     *   BEST_FIT takes the smallest gap that fits, the lowest of equals
+     *
+     * for node-heap and boundary-tag pools (in which a block takes
+     * MEM_TAG_BLOCK_SIZE bytes and its memory follows the header).
+     */
+
+    const unsigned num_ops = 2000;
+    const unsigned max_live = 200;
+    const unsigned max_size = 3000;
+    const unsigned flags[] = { POOL_DEFAULT, POOL_BOUNDARY_TAGS };
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (int i = 0; i < 4; i++) {
+        alloc_policy policy = (i & 1) ? BEST_FIT : FIRST_FIT;
+        unsigned flag = flags[i >> 1];
+        const pool_opts_t opts = { flag };
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+
+        alloc_pt live[200];
+        unsigned numLive = 0;
+        // a fixed sequence, the same on every run
+        unsigned long long seed = 42 + i;
+        size_t hdrSize = (size_t) -1;
+
+        for (unsigned op = 0; op < num_ops; op++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            unsigned rnd = (unsigned) (seed >> 33);
+            if (numLive > 0 && (numLive == max_live || rnd % 3 == 0)) {
+                unsigned ix = (rnd >> 2) % numLive;
+                assert_int_equal(mem_del_alloc(pool, live[ix]), ALLOC_OK);
+                live[ix] = live[--numLive];
+                continue;
+            }
+
+            size_t size = 1 + (rnd >> 2) % max_size;
+            size_t need = (flag & POOL_BOUNDARY_TAGS) ? MEM_TAG_BLOCK_SIZE(size) : size;
+
+            // the model: where the policy puts the block
+            pool_segment_pt segs = NULL;
+            unsigned numSegs = 0;
+            mem_inspect_pool(pool, &segs, &numSegs);
+            assert_non_null(segs);
+            size_t offset = 0;
+            size_t expected = (size_t) -1;
+            size_t expectedSize = 0;
+            for (unsigned u = 0; u < numSegs; offset += segs[u].size, u++) {
+                if (segs[u].allocated || segs[u].size < need) {
+                    continue;
+                }
+                if (expected == (size_t) -1 ||
+                    (policy == BEST_FIT && segs[u].size < expectedSize)) {
+                    expected = offset;
+                    expectedSize = segs[u].size;
+                }
+                if (policy == FIRST_FIT) {
+                    break;
+                }
+            }
+            free(segs);
+
+            alloc_pt alloc = mem_new_alloc(pool, size);
+            if (expected == (size_t) -1) {
+                assert_null(alloc);
+                continue;
+            }
+            assert_non_null(alloc);
+            assert_int_equal(alloc->size, size);
+            size_t at = (size_t) (alloc->mem - pool->mem);
+            // the header of a tag pool's block: where the first block
+            // of the empty pool starts its memory
+            if (hdrSize == (size_t) -1) {
+                hdrSize = at;
+            }
+            assert_int_equal(at - hdrSize, expected);
+            live[numLive++] = alloc;
+        }
+
+        while (numLive > 0) {
+            assert_int_equal(mem_del_alloc(pool, live[--numLive]), ALLOC_OK);
+        }
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_deferred_coalescing(void **state) {
+    INFO("Freed blocks are reused by size and merged when nothing fits");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_opts_t opts = { POOL_DEFERRED_COALESCING };
+    const size_t rest = POOL_SIZE - 3110;
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+
+        alloc_pt alloc1 = mem_new_alloc(pool, 100);
+        assert_non_null(alloc1);
+        alloc_pt alloc2 = mem_new_alloc(pool, 1000);
+        assert_non_null(alloc2);
+        alloc_pt alloc3 = mem_new_alloc(pool, 10);
+        assert_non_null(alloc3);
+        alloc_pt alloc4 = mem_new_alloc(pool, 2000);
+        assert_non_null(alloc4);
+        alloc_pt alloc5 = mem_new_alloc(pool, rest);
+        assert_non_null(alloc5);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, 5, 0);
+
+        // a freed block is reused for the same size as it is
+        char *mem2 = alloc2->mem;
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE - 1000, 4, 1);
+        alloc2 = mem_new_alloc(pool, 1000);
+        assert_non_null(alloc2);
+        assert_ptr_equal(alloc2->mem, mem2);
+
+        // freed neighbors stay apart...
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+        pool_segment_t exp1[5] =
+                {
+                        {100, 0},
+                        {1000, 0},
+                        {10, 0},
+                        {2000, 1},
+                        {rest, 1}
+                };
+        check_pool(pool, exp1);
+        check_metadata(pool, policy, POOL_SIZE, 2000 + rest, 2, 3);
+
+        // ...until nothing fits without merging them
+        alloc1 = mem_new_alloc(pool, 1110);
+        assert_non_null(alloc1);
+        assert_ptr_equal(alloc1->mem, pool->mem);
+
+        pool_segment_t exp2[3] =
+                {
+                        {1110, 1},
+                        {2000, 1},
+                        {rest, 1}
+                };
+        check_pool(pool, exp2);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, 3, 0);
+
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+
+        // closing merges what is left
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_deferred_full_bins(void **state) {
+    INFO("A freed block with no quick list left is merged on its own");
+
+    /*
+     * Free more distinct sizes than there are quick bins: the first
+     * MEM_QUICK_BINS go on quick lists, the rest are merged as they are
+     * freed, with the indexed gaps next to them only, and the quick
+     * lists are left for a batch merge.
+     */
+
+    const unsigned num_blocks = 100;
+    const unsigned num_quick = 64; // MEM_QUICK_BINS
+    size_t total = 0;
+    for (unsigned i = 0; i < num_blocks; i++) {
+        total += 100 + 8 * i;
+    }
+    const size_t rest = POOL_SIZE - total;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_opts_t opts = { POOL_DEFERRED_COALESCING };
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+
+        alloc_pt allocs[100];
+        for (unsigned i = 0; i < num_blocks; i++) {
+            allocs[i] = mem_new_alloc(pool, 100 + 8 * i);
+            assert_non_null(allocs[i]);
+        }
+        alloc_pt last = mem_new_alloc(pool, rest);
+        assert_non_null(last);
+
+        char *mem5 = allocs[5]->mem;
+        size_t merged = 0;
+        for (unsigned i = 0; i < num_blocks; i++) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            if (i >= num_quick) {
+                merged += 100 + 8 * i;
+            }
+        }
+
+        pool_segment_t exp[66];
+        for (unsigned i = 0; i < num_quick; i++) {
+            exp[i].size = 100 + 8 * i;
+            exp[i].allocated = 0;
+        }
+        exp[num_quick].size = merged;
+        exp[num_quick].allocated = 0;
+        exp[num_quick + 1].size = rest;
+        exp[num_quick + 1].allocated = 1;
+        check_pool(pool, exp);
+        check_metadata(pool, policy, POOL_SIZE, rest, 1, num_quick + 1);
+
+        // the quick lists still hand their blocks back by size
+        allocs[5] = mem_new_alloc(pool, 100 + 8 * 5);
+        assert_non_null(allocs[5]);
+        assert_ptr_equal(allocs[5]->mem, mem5);
+        assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK);
+
+        // and the batch merge makes one gap of them all
+        alloc_pt alloc = mem_new_alloc(pool, total);
+        assert_non_null(alloc);
+        assert_ptr_equal(alloc->mem, pool->mem);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, 2, 0);
+
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, last), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_background_maintenance(void **state) {
+    INFO("The maintenance thread merges the freed blocks of an idle pool");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    maint_opts_t maint = { 10, 0 };
+    pool_opts_t opts = { POOL_BACKGROUND };
+    alloc_pt allocs[100];
+    struct timespec tick = { 0, 1000000 };
+
+    assert_int_equal(mem_maintenance_wake(), ALLOC_FAIL);
+    assert_int_equal(mem_maintenance_start(&maint), ALLOC_OK);
+    assert_int_equal(mem_maintenance_start(&maint), ALLOC_CALLED_AGAIN);
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+
+        for (unsigned i = 0; i < 100; ++i) {
+            allocs[i] = mem_new_alloc(pool, 100);
+            assert_non_null(allocs[i]);
+        }
+        // the freed blocks wait on a quick list
+        for (unsigned i = 0; i < 100; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+
+        pool_t stats;
+        assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        assert_int_equal(stats.num_allocs, 0);
+        assert_int_equal(stats.num_gaps, 101);
+
+        // until the pool is seen idle
+        assert_int_equal(mem_maintenance_wake(), ALLOC_OK);
+        for (unsigned t = 0; t < 5000 && stats.num_gaps != 1; ++t) {
+            thrd_sleep(&tick, NULL);
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        }
+        assert_int_equal(stats.num_gaps, 1);
+
+        pool_segment_t exp[1] =
+                {
+                        {POOL_SIZE, 0}
+                };
+        check_pool(pool, exp);
+
+        // and the pool is as good as new
+        allocs[0] = mem_new_alloc(pool, POOL_SIZE);
+        assert_non_null(allocs[0]);
+        assert_ptr_equal(allocs[0]->mem, pool->mem);
+        assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_maintenance_stop(), ALLOC_OK);
+    assert_int_equal(mem_maintenance_stop(), ALLOC_CALLED_AGAIN);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+typedef struct _remote_free_args {
+    pool_pt pool;
+    alloc_pt *allocs;
+    unsigned num_allocs;
+} remote_free_args_t;
+
+static void *remote_free_thread(void *arg) {
+    remote_free_args_t *args = (remote_free_args_t *) arg;
+
+    // not the owner: can't allocate, frees are queued
+    args->allocs[args->num_allocs] = mem_new_alloc(args->pool, 10);
+    for (unsigned i = 0; i < args->num_allocs; ++i) {
+        if (mem_del_alloc(args->pool, args->allocs[i]) != ALLOC_OK) {
+            return NULL;
+        }
+    }
+    return arg;
+}
+
+static void test_pool_decay_purge(void **state) {
+    INFO("The free pages of a gap are purged once it has decayed");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    maint_opts_t slow = { 10, 0, 3600000, 0 };
+    maint_opts_t fast = { 10, 0, 1, 0 };
+    pool_opts_t opts = { POOL_BACKGROUND };
+    alloc_pt allocs[10];
+    struct timespec tick = { 0, 1000000 };
+    pool_t stats;
+
+    for (unsigned lazy = 0; lazy <= 1; ++lazy) {
+        slow.lazy = fast.lazy = lazy;
+        assert_int_equal(mem_maintenance_start(&slow), ALLOC_OK);
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &opts);
+        assert_non_null(pool);
+
+        // the pages of the whole pool are written to, then freed
+        for (unsigned i = 0; i < 10; ++i) {
+            allocs[i] = mem_new_alloc(pool, POOL_SIZE / 10);
+            assert_non_null(allocs[i]);
+            for (unsigned j = 0; j < POOL_SIZE / 10; j += 1024) {
+                allocs[i]->mem[j] = 1;
+            }
+        }
+        for (unsigned i = 0; i < 10; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+
+        // merged once the pool is idle, but not purged before the decay
+        assert_int_equal(mem_maintenance_wake(), ALLOC_OK);
+        assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        for (unsigned t = 0; t < 5000 && stats.num_gaps != 1; ++t) {
+            thrd_sleep(&tick, NULL);
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        }
+        assert_int_equal(stats.num_gaps, 1);
+        for (unsigned t = 0; t < 30; ++t) {
+            thrd_sleep(&tick, NULL);
+        }
+        assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        assert_int_equal(stats.purged_size, 0);
+        assert_int_equal(stats.resident_size, POOL_SIZE);
+
+        // a short decay: all but the partial pages at the ends
+        assert_int_equal(mem_maintenance_stop(), ALLOC_OK);
+        assert_int_equal(mem_maintenance_start(&fast), ALLOC_OK);
+        for (unsigned t = 0; t < 5000 && stats.purged_size == 0; ++t) {
+            thrd_sleep(&tick, NULL);
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        }
+        assert_true(stats.purged_size > POOL_SIZE - 2 * 65536);
+        assert_true(stats.purged_size <= POOL_SIZE);
+        assert_int_equal(stats.purged_size + stats.resident_size, POOL_SIZE);
+
+        // an allocation takes the purged pages back (the rest of the gap
+        // may be purged again by now)
+        allocs[0] = mem_new_alloc(pool, POOL_SIZE / 2);
+        assert_non_null(allocs[0]);
+        assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        assert_true(stats.purged_size <= POOL_SIZE / 2);
+        assert_int_equal(stats.purged_size + stats.resident_size, POOL_SIZE);
+        for (unsigned j = 0; j < POOL_SIZE / 2; ++j) {
+            allocs[0]->mem[j] = 2;
+        }
+
+        // and the rest of the gap is purged again
+        for (unsigned t = 0; t < 5000 && stats.purged_size == 0; ++t) {
+            thrd_sleep(&tick, NULL);
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        }
+        assert_true(stats.purged_size > POOL_SIZE / 2 - 2 * 65536);
+        assert_true(stats.purged_size <= POOL_SIZE / 2);
+        assert_int_equal(allocs[0]->mem[POOL_SIZE / 2 - 1], 2);
+
+        assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+        assert_int_equal(mem_maintenance_stop(), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_reserve(void **state) {
+    INFO("A reserved pool commits its memory as allocations reach into it");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_opts_t opts = { POOL_RESERVE };
+    pool_opts_t tagOpts = { POOL_RESERVE | POOL_BOUNDARY_TAGS };
+    alloc_pt allocs[10];
+    pool_t stats;
+    // 32-bit offsets keep a node-heap pool under 1 GiB
+#ifdef MEM_POOL_SMALL_OFFSETS
+    const size_t nodeHeapSize = (size_t) 1 << 29;
+#else
+    const size_t nodeHeapSize = (size_t) 1 << 33;
+#endif
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        // large node-heap and boundary-tag pools
+        pool_pt pools[2] = {
+            mem_pool_open_opts(nodeHeapSize, policy, &opts),
+            mem_pool_open_opts((size_t) 1 << 36, policy, &tagOpts)
+        };
+        for (unsigned p = 0; p < 2; ++p) {
+            pool_pt pool = pools[p];
+            assert_non_null(pool);
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+            assert_true(stats.resident_size < 16 << 20);
+
+            // written to all over, committed only as far as they go
+            for (unsigned i = 0; i < 10; ++i) {
+                allocs[i] = mem_new_alloc(pool, 100000);
+                assert_non_null(allocs[i]);
+                for (unsigned j = 0; j < 100000; ++j) {
+                    allocs[i]->mem[j] = (char) i;
+                }
+            }
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+            assert_true(stats.resident_size >= 1000000);
+            assert_true(stats.resident_size < 16 << 20);
+            assert_int_equal(stats.num_gaps, 1);
+
+            // reused without committing more
+            size_t resident = stats.resident_size;
+            for (unsigned i = 0; i < 10; i += 2) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+                allocs[i] = mem_new_alloc(pool, 50000);
+                assert_non_null(allocs[i]);
+                allocs[i]->mem[49999] = 1;
+            }
+            assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+            assert_int_equal(stats.resident_size, resident);
+            for (unsigned i = 1; i < 10; i += 2) {
+                assert_int_equal(allocs[i]->mem[99999], (char) i);
+            }
+
+            // far beyond what is committed, the whole node-heap pool
+            for (unsigned i = 0; i < 10; ++i) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            }
+            allocs[0] = mem_new_alloc(pool, (size_t) 1 << 29);
+            assert_non_null(allocs[0]);
+            allocs[0]->mem[((size_t) 1 << 29) - 1] = 1;
+            assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+#ifndef MEM_POOL_SMALL_OFFSETS
+            // and past 1 GiB
+            allocs[0] = mem_new_alloc(pool, (size_t) 5 << 28);
+            assert_non_null(allocs[0]);
+            allocs[1] = mem_new_alloc(pool, 100);
+            assert_non_null(allocs[1]);
+            assert_true(mem_pool_offset(pool, allocs[1]) >= (size_t) 5 << 28);
+            allocs[1]->mem[99] = 1;
+            assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+            assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+#endif
+
+            assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        }
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_numa_placement(void **state) {
+    INFO("A NUMA pool works, and falls back when it can't be placed");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    // the calling thread's node, node 0 (always there), and no such node
+    int nodes[3] = { POOL_NUMA_LOCAL, 0, 4096 };
+    alloc_pt allocs[100];
+
+    for (unsigned n = 0; n < 3; ++n) {
+        for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+            pool_opts_t opts = { POOL_NUMA_NODE, nodes[n] };
+            pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+            assert_non_null(pool);
+
+            // placed where the kernel lets it, never on a node that isn't there
+            int node = mem_pool_numa_node(pool);
+            if (nodes[n] == 4096) {
+                assert_int_equal(node, -1);
+            } else if (nodes[n] == 0) {
+                assert_true(node == 0 || node == -1);
+            } else {
+                assert_true(node >= -1);
+            }
+
+            // enough allocations to grow the metadata
+            for (unsigned i = 0; i < 100; ++i) {
+                allocs[i] = mem_new_alloc(pool, 100);
+                assert_non_null(allocs[i]);
+            }
+            for (unsigned i = 0; i < 100; i += 2) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            }
+            for (unsigned i = 1; i < 100; i += 2) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            }
+
+            pool_segment_t exp[1] =
+                    {
+                            {POOL_SIZE, 0}
+                    };
+            check_pool(pool, exp);
+
+            assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        }
+    }
+
+    // an unplaced pool reports no node
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_numa_node(pool), -1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_file(void **state) {
+    INFO("A file-backed pool keeps its allocations across close and reopen");
+
+    const char *path = "test_pool_file.pool";
+    remove(path);
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    // a new file: a root holding the offsets of the other allocations
+    pool_pt pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_null(mem_pool_get_root(pool));
+    alloc_pt root = mem_new_alloc(pool, 10 * sizeof(size_t));
+    assert_non_null(root);
+    for (unsigned i = 0; i < 10; ++i) {
+        alloc_pt alloc = mem_new_alloc(pool, 100 + i);
+        assert_non_null(alloc);
+        for (unsigned j = 0; j < alloc->size; ++j) {
+            alloc->mem[j] = (char) i;
+        }
+        ((size_t *) root->mem)[i] = (size_t) (alloc->mem - pool->mem);
+    }
+    assert_int_equal(mem_pool_set_root(pool, root), ALLOC_OK);
+    assert_int_equal(mem_pool_sync(pool), ALLOC_OK);
+    pool_t before;
+    assert_int_equal(mem_pool_stats(pool, &before), ALLOC_OK);
+    // closing doesn't need the pool to be empty
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // the size of an existing file can be left out, but not changed
+    assert_null(mem_pool_open_file(path, POOL_SIZE + 1, FIRST_FIT));
+    pool = mem_pool_open_file(path, 0, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->total_size, POOL_SIZE);
+    assert_int_equal(pool->num_allocs, before.num_allocs);
+    assert_int_equal(pool->alloc_size, before.alloc_size);
+    assert_int_equal(pool->num_gaps, before.num_gaps);
+    root = mem_pool_get_root(pool);
+    assert_non_null(root);
+    assert_int_equal(root->size, 10 * sizeof(size_t));
+    for (unsigned i = 0; i < 10; ++i) {
+        char *mem = pool->mem + ((size_t *) root->mem)[i];
+        for (unsigned j = 0; j < 100 + i; ++j) {
+            assert_int_equal(mem[j], (char) i);
+        }
+    }
+    // a freed root is no root
+    assert_int_equal(mem_del_alloc(pool, root), ALLOC_OK);
+    assert_null(mem_pool_get_root(pool));
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a process that dies with the pool open leaves it to be recovered
+    pid_t child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+        if (pool == NULL || mem_new_alloc(pool, 1000) == NULL) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int childStatus;
+    assert_int_equal(waitpid(child, &childStatus, 0), child);
+    assert_true(WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0);
+
+    pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->num_allocs, before.num_allocs);
+    assert_int_equal(pool->alloc_size, before.alloc_size - 10 * sizeof(size_t) + 1000);
+    pool_segment_pt segs;
+    unsigned numSegs;
+    mem_inspect_pool(pool, &segs, &numSegs);
+    // the freed root, the 10 allocations, the child's, and the rest
+    assert_int_equal(numSegs, 13);
+    assert_int_equal(segs[0].allocated, 0);
+    assert_int_equal(segs[11].allocated, 1);
+    assert_int_equal(segs[12].allocated, 0);
+    free(segs);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a block whose record wasn't written before the process died (its
+    // size still the links of the gap) is recovered with all of its block
+    child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+        alloc_pt alloc = (pool != NULL) ? mem_new_alloc(pool, 500) : NULL;
+        if (alloc == NULL) {
+            _exit(1);
+        }
+        alloc->size = SIZE_MAX;
+        _exit(0);
+    }
+    assert_int_equal(waitpid(child, &childStatus, 0), child);
+    assert_true(WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0);
+
+    pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->num_allocs, before.num_allocs + 1);
+    assert_int_equal(pool->alloc_size, before.alloc_size - 10 * sizeof(size_t) + 1000 +
+                                       MEM_TAG_BLOCK_SIZE(500) - MEM_TAG_BLOCK_SIZE(0));
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a file that isn't a pool
+    FILE *junk = fopen(path, "w");
+    assert_non_null(junk);
+    fputs("not a pool", junk);
+    fclose(junk);
+    assert_null(mem_pool_open_file(path, POOL_SIZE, FIRST_FIT));
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    remove(path);
+}
+
+static void test_pool_shared(void **state) {
+    INFO("Processes allocate from a shared pool and pass blocks by offset");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    // an anonymous pool, shared with the children forked after it
+    pool_pt pool = mem_pool_open_shared(NULL, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    int pipeFds[2];
+    assert_int_equal(pipe(pipeFds), 0);
+    pid_t children[4];
+    for (unsigned c = 0; c < 4; ++c) {
+        children[c] = fork();
+        assert_true(children[c] >= 0);
+        if (children[c] == 0) {
+            // churn alongside the other children, then hand 10 blocks
+            // over to the parent
+            for (unsigned i = 0; i < 1000; ++i) {
+                alloc_pt alloc = mem_new_alloc(pool, 64 + i % 64);
+                if (alloc == NULL || mem_del_alloc(pool, alloc) != ALLOC_OK) {
+                    _exit(1);
+                }
+            }
+            for (unsigned i = 0; i < 10; ++i) {
+                alloc_pt alloc = mem_new_alloc(pool, 100);
+                if (alloc == NULL) {
+                    _exit(1);
+                }
+                for (unsigned j = 0; j < 100; ++j) {
+                    alloc->mem[j] = (char) c;
+                }
+                size_t offset = mem_pool_offset(pool, alloc);
+                if (write(pipeFds[1], &offset, sizeof(offset)) != sizeof(offset)) {
+                    _exit(1);
+                }
+            }
+            _exit(0);
+        }
+    }
+    close(pipeFds[1]);
+    for (unsigned c = 0; c < 4; ++c) {
+        int childStatus;
+        assert_int_equal(waitpid(children[c], &childStatus, 0), children[c]);
+        assert_true(WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0);
+    }
+    pool_t stats;
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 40);
+    assert_int_equal(stats.alloc_size, 4000);
+    // the parent frees the children's blocks
+    size_t offset;
+    unsigned received = 0;
+    while (read(pipeFds[0], &offset, sizeof(offset)) == sizeof(offset)) {
+        alloc_pt alloc = mem_pool_alloc_at(pool, offset);
+        assert_non_null(alloc);
+        assert_int_equal(alloc->size, 100);
+        assert_ptr_equal(alloc->mem, pool->mem + offset);
+        char c = alloc->mem[0];
+        assert_true(c >= 0 && c < 4);
+        for (unsigned j = 0; j < 100; ++j) {
+            assert_int_equal(alloc->mem[j], c);
+        }
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+        received++;
+    }
+    close(pipeFds[0]);
+    assert_int_equal(received, 40);
+    assert_null(mem_pool_alloc_at(pool, 1));
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 0);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // a named pool, which another process attaches to
+    const char *name = "/test_pool_shared";
+    shm_unlink(name);
+    pool = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    alloc_pt root = mem_new_alloc(pool, 100);
+    assert_non_null(root);
+    root->mem[0] = 1;
+    size_t rootOffset = mem_pool_offset(pool, root);
+    assert_int_equal(mem_pool_set_root(pool, root), ALLOC_OK);
+    pid_t child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        // the size can be left out
+        pool_pt attached = mem_pool_open_shared(name, 0, BEST_FIT);
+        if (attached == NULL || mem_pool_get_root(attached) == NULL ||
+            mem_pool_get_root(attached)->mem[0] != 1) {
+            _exit(1);
+        }
+        // pass a new root back
+        alloc_pt alloc = mem_new_alloc(attached, 200);
+        if (alloc == NULL || mem_pool_set_root(attached, alloc) != ALLOC_OK) {
+            _exit(1);
+        }
+        alloc->mem[0] = 2;
+        _exit(mem_pool_close(attached) == ALLOC_OK ? 0 : 1);
+    }
+    int childStatus;
+    assert_int_equal(waitpid(child, &childStatus, 0), child);
+    assert_true(WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0);
+    // the record is this process's, the child had its own: it still
+    // points into this mapping
+    assert_ptr_equal(root->mem, pool->mem + rootOffset);
+    assert_int_equal(mem_pool_offset(pool, root), rootOffset);
+    // so does a second mapping of the pool, in the same process
+    pool_pt second = mem_pool_open_shared(name, 0, BEST_FIT);
+    assert_non_null(second);
+    assert_ptr_not_equal(second->mem, pool->mem);
+    alloc_pt seen = mem_pool_alloc_at(second, rootOffset);
+    assert_non_null(seen);
+    assert_ptr_not_equal(seen, root);
+    assert_ptr_equal(seen->mem, second->mem + rootOffset);
+    assert_int_equal(seen->mem[0], 1);
+    assert_ptr_equal(root->mem, pool->mem + rootOffset);
+    // and takes only its own records
+    assert_int_equal(mem_del_alloc(second, root), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(second), ALLOC_OK);
+    alloc_pt newRoot = mem_pool_get_root(pool);
+    assert_non_null(newRoot);
+    assert_int_equal(newRoot->size, 200);
+    assert_int_equal(newRoot->mem[0], 2);
+    assert_int_equal(mem_del_alloc(pool, newRoot), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, root), ALLOC_OK);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 0);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(shm_unlink(name), 0);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_owner_thread(void **state) {
+    INFO("Remote frees from a non-owner thread are returned to the owner's pool");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    const unsigned num_allocs = 50;
+    alloc_pt allocs[51];
+    pool_opts_t opts = { POOL_OWNER_THREAD };
+
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &opts);
+    assert_non_null(pool);
+
+    for (unsigned i = 0; i < num_allocs; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+
+    remote_free_args_t args = { pool, allocs, num_allocs };
+    pthread_t thread;
+    void *result = NULL;
+    assert_int_equal(pthread_create(&thread, NULL, remote_free_thread, &args), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_ptr_equal(result, &args);
+    assert_null(allocs[num_allocs]);
+
+    // the frees are only queued until the owner allocates again
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, num_allocs * 100, num_allocs, 1);
+
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+
+    pool_segment_t exp[2] =
+            {
+                    {100, 1},
+                    {POOL_SIZE - 100, 0}
+            };
+    check_pool(pool, exp);
+
+#ifndef NDEBUG
+    // a second remote free of a record already queued would link it to
+    // itself: a debug build stops at it
+    pid_t child = fork();
+    assert_true(child >= 0);
+    if (child == 0) {
+        allocs[0] = alloc;
+        allocs[1] = alloc;
+        args.num_allocs = 2;
+        if (pthread_create(&thread, NULL, remote_free_thread, &args) == 0) {
+            pthread_join(thread, NULL);
+        }
+        _exit(0);
+    }
+    int childStatus;
+    assert_int_equal(waitpid(child, &childStatus, 0), child);
+    assert_true(WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGABRT);
+#endif
+
+    // a queued free is taken back on close too
+    allocs[0] = alloc;
+    args.allocs = allocs;
+    args.num_allocs = 1;
+    assert_int_equal(pthread_create(&thread, NULL, remote_free_thread, &args), 0);
+    assert_int_equal(pthread_join(thread, &result), 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+// allocates and frees in a shared pool, round after round
+static void *locked_pool_thread(void *arg) {
+    pool_pt pool = (pool_pt) arg;
+    char *ptrs[20];
+
+    for (unsigned round = 0; round < 2000; ++round) {
+        for (unsigned i = 0; i < 20; ++i) {
+            ptrs[i] = mem_alloc(pool, 10 + i * 10);
+            if (ptrs[i] == NULL) {
+                return NULL;
+            }
+            ptrs[i][0] = (char) i;
+        }
+        for (unsigned i = 0; i < 20; ++i) {
+            if (ptrs[i][0] != (char) i || mem_release(pool, ptrs[i]) != ALLOC_OK) {
+                return NULL;
+            }
+        }
+    }
+    return arg;
+}
+
+static void test_pool_locked(void **state) {
+    INFO("Threads share a locked pool, and a fork between their calls leaves it usable");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    const unsigned num_threads = 4;
+    pthread_t threads[4];
+    pool_opts_t opts = { POOL_LOCKED };
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+
+        for (unsigned t = 0; t < num_threads; ++t) {
+            assert_int_equal(pthread_create(&threads[t], NULL, locked_pool_thread, pool), 0);
+        }
+
+        // the threads hold the pool's lock in turn, the child has none
+        mem_fork_prepare();
+        pid_t child = fork();
+        if (child == 0) {
+            mem_fork_child();
+            char *ptr = mem_alloc(pool, 100);
+            _exit(ptr != NULL && mem_release(pool, ptr) == ALLOC_OK ? 0 : 1);
+        }
+        mem_fork_parent();
+        assert_true(child > 0);
+        int childStatus;
+        assert_int_equal(waitpid(child, &childStatus, 0), child);
+        assert_true(WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0);
+
+        for (unsigned t = 0; t < num_threads; ++t) {
+            void *result = NULL;
+            assert_int_equal(pthread_join(threads[t], &result), 0);
+            assert_ptr_equal(result, pool);
+        }
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_sharded(void **state) {
+    INFO("A sharded pool steals from the other shards and frees by address");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    const unsigned num_shards = 4;
+    const size_t shard_size = POOL_SIZE / num_shards;
+    alloc_pt allocs[4];
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open_sharded(POOL_SIZE, policy, num_shards);
+        assert_non_null(pool);
+
+        // a whole shard at a time: the shard of the current CPU
+        // fills first, the rest come from the other shards
+        for (unsigned i = 0; i < num_shards; ++i) {
+            allocs[i] = mem_new_alloc(pool, shard_size);
+            assert_non_null(allocs[i]);
+            assert_in_range(allocs[i]->mem - pool->mem, 0, POOL_SIZE - shard_size);
+        }
+        assert_null(mem_new_alloc(pool, 1));
+
+        pool_segment_t exp1[4] =
+                {
+                        {shard_size, 1},
+                        {shard_size, 1},
+                        {shard_size, 1},
+                        {shard_size, 1}
+                };
+        check_pool(pool, exp1);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, num_shards, 0);
+        assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+
+        // frees go back to the shard holding the memory
+        for (unsigned i = 0; i < num_shards; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+
+        pool_segment_t exp2[4] =
+                {
+                        {shard_size, 0},
+                        {shard_size, 0},
+                        {shard_size, 0},
+                        {shard_size, 0}
+                };
+        check_pool(pool, exp2);
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, num_shards);
+
+        // nothing larger than a shard fits
+        assert_null(mem_new_alloc(pool, shard_size + 1));
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+typedef struct _monitor_args {
+    pool_pt pool;
+    atomic_int stop;
+    unsigned num_reads;
+} monitor_args_t;
+
+// every snapshot must be consistent: all allocations are 100 bytes and
+// the segments tile the pool
+static void *monitor_thread(void *arg) {
+    monitor_args_t *args = (monitor_args_t *) arg;
+
+    while (!atomic_load(&args->stop)) {
+        pool_t stats;
+        pool_segment_pt segs = NULL;
+        unsigned size = 0;
+        size_t total = 0;
+        unsigned allocs = 0;
+
+        if (mem_pool_stats(args->pool, &stats) != ALLOC_OK ||
+            stats.alloc_size != stats.num_allocs * 100) {
+            return NULL;
+        }
+        mem_inspect_pool(args->pool, &segs, &size);
+        if (segs == NULL) {
+            return NULL;
+        }
+        for (unsigned u = 0; u < size; u++) {
+            total += segs[u].size;
+            allocs += segs[u].allocated;
+            if (u > 0 && !segs[u].allocated && !segs[u - 1].allocated) {
+                free(segs);
+                return NULL;
+            }
+        }
+        free(segs);
+        if (total != POOL_SIZE || allocs > 500) {
+            return NULL;
+        }
+        args->num_reads++;
+    }
+    return arg;
+}
+
+static void test_pool_raw_alloc(void **state) {
+    INFO("Blocks are allocated and freed by address, like malloc and free");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    const unsigned num_allocs = 2000;
+    char *ptrs[2000];
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open(POOL_SIZE, policy);
+        pool_pt other = mem_pool_open(POOL_SIZE, policy);
+        assert_non_null(pool);
+        assert_non_null(other);
+
+        // enough blocks for the node heap to grow under them
+        for (unsigned i = 0; i < num_allocs; ++i) {
+            ptrs[i] = mem_alloc(pool, 1 + i % 100);
+            assert_non_null(ptrs[i]);
+            assert_in_range(ptrs[i] - pool->mem, 0, POOL_SIZE - 1);
+            ptrs[i][0] = (char) i;
+        }
+        assert_null(mem_alloc(pool, POOL_SIZE));
+        for (unsigned i = 0; i < num_allocs; ++i) {
+            assert_int_equal(ptrs[i][0], (char) i);
+            assert_int_equal(mem_ptr_size(ptrs[i]), 1 + i % 100);
+        }
+        assert_int_equal(mem_ptr_size(ptrs[99] + 1), 0);
+
+        // only the pool of a block frees it
+        assert_int_equal(mem_release(other, ptrs[0]), ALLOC_FAIL);
+        assert_int_equal(mem_release(pool, ptrs[99] + 1), ALLOC_FAIL);
+
+        for (unsigned i = 0; i < num_allocs; i += 2) {
+            assert_int_equal(mem_release(pool, ptrs[i]), ALLOC_OK);
+        }
+        assert_int_equal(mem_release(pool, ptrs[0]), ALLOC_FAIL);
+        assert_int_equal(mem_ptr_size(ptrs[0]), 0);
+        assert_int_equal(pool->num_allocs, num_allocs / 2);
+        for (unsigned i = 1; i < num_allocs; i += 2) {
+            assert_int_equal(ptrs[i][0], (char) i);
+            assert_int_equal(mem_release(pool, ptrs[i]), ALLOC_OK);
+        }
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    }
+
+    // a boundary-tag pool finds the block by its header: an address
+    // inside a block, even over a word that looks like a tag, or of a
+    // block already freed into the gap before it, frees nothing
+    pool_opts_t tagOpts = { POOL_BOUNDARY_TAGS };
+    pool_pt tags = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &tagOpts);
+    assert_non_null(tags);
+    char *first = mem_alloc(tags, 200);
+    char *second = mem_alloc(tags, 200);
+    assert_non_null(first);
+    assert_non_null(second);
+    *(size_t *) (first + 8) = 65;
+    *(size_t *) (first + 16) = 7;
+    assert_int_equal(mem_release(tags, first + 32), ALLOC_FAIL);
+    assert_int_equal(mem_release_sized(tags, first + 32, 7), ALLOC_FAIL);
+    assert_int_equal(mem_release(tags, first + 1), ALLOC_FAIL);
+    assert_int_equal(tags->num_allocs, 2);
+    assert_int_equal(mem_release(tags, first), ALLOC_OK);
+    assert_int_equal(mem_release(tags, second), ALLOC_OK);
+    assert_int_equal(mem_release(tags, second), ALLOC_FAIL);
+    assert_int_equal(mem_release_sized(tags, second, 200), ALLOC_FAIL);
+    assert_int_equal(mem_release(tags, first), ALLOC_FAIL);
+    check_metadata(tags, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(tags), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_release_sized(void **state) {
+    INFO("Blocks freed with their size are checked against it");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    const unsigned flags[] = { POOL_DEFAULT, POOL_DEFERRED_COALESCING, POOL_BOUNDARY_TAGS, POOL_BACKGROUND };
+    const unsigned num_allocs = 300;
+    char *ptrs[300];
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        for (unsigned f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+            pool_opts_t opts = { flags[f] };
+            pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+            assert_non_null(pool);
+
+            for (unsigned i = 0; i < num_allocs; ++i) {
+                ptrs[i] = mem_alloc(pool, 1 + i % 64);
+                assert_non_null(ptrs[i]);
+            }
+            // a size of 0 or an address inside a block frees nothing
+            for (unsigned i = 0; i < num_allocs; i += 3) {
+                assert_int_equal(mem_release_sized(pool, ptrs[i], 0), ALLOC_FAIL);
+            }
+            assert_int_equal(mem_release_sized(pool, ptrs[1] + 1, 1), ALLOC_FAIL);
+            assert_int_equal(pool->num_allocs, num_allocs);
+
+            // a wrong size frees the block, and says so
+            for (unsigned i = 0; i < num_allocs; ++i) {
+                status = (i % 3 == 0) ? ALLOC_BAD_SIZE : ALLOC_OK;
+                assert_int_equal(mem_release_sized(pool, ptrs[i], (i % 3 == 0) ? 2 + i % 64 : 1 + i % 64), status);
+                assert_int_equal(pool->num_allocs, num_allocs - 1 - i);
+            }
+            assert_int_equal(mem_release_sized(pool, ptrs[0], 1), ALLOC_FAIL);
+
+            assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        }
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_granularity(void **state) {
+    INFO("Block sizes are rounded, and tiny remainders go with the block");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    // the granularity is a power of 2, and not too large
+    pool_opts_t bad = { POOL_DEFAULT, 0, 24, 0 };
+    assert_null(mem_pool_open_opts(POOL_SIZE, BEST_FIT, &bad));
+    bad.granularity = MEM_MAX_GRANULARITY * 2;
+    assert_null(mem_pool_open_opts(POOL_SIZE, BEST_FIT, &bad));
+
+    const unsigned num_allocs = 100;
+    alloc_pt allocs[100];
+    pool_frag_t frag;
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        // blocks of multiples of the granularity, records of the sizes asked for
+        pool_opts_t opts = { POOL_DEFAULT, 0, 16, 0 };
+        pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+        size_t requested = 0, taken = 0;
+        for (unsigned i = 0; i < num_allocs; ++i) {
+            size_t size = 1 + (i * 7) % 50;
+            allocs[i] = mem_new_alloc(pool, size);
+            assert_non_null(allocs[i]);
+            assert_int_equal(allocs[i]->size, size);
+            assert_int_equal((allocs[i]->mem - pool->mem) % 16, 0);
+            requested += size;
+            taken += (size + 15) & ~(size_t) 15;
+        }
+        check_metadata(pool, policy, POOL_SIZE, taken, num_allocs, 1);
+        assert_int_equal(mem_pool_frag(pool, &frag), ALLOC_OK);
+        assert_int_equal(frag.requested_size, requested);
+        assert_int_equal(frag.alloc_size, taken);
+        assert_int_equal(frag.free_size, POOL_SIZE - taken);
+        assert_int_equal(frag.largest_gap, POOL_SIZE - taken);
+        assert_int_equal(frag.num_gaps, 1);
+        assert_true(frag.internal > 0.0 && frag.external == 0.0);
+        for (unsigned i = 0; i < num_allocs; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+        // a remainder under the minimum split is handed out with the block
+        opts = (pool_opts_t) { POOL_DEFAULT, 0, 0, 32 };
+        pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+        alloc_pt a = mem_new_alloc(pool, 100);
+        alloc_pt b = mem_new_alloc(pool, 100);
+        alloc_pt c = mem_new_alloc(pool, POOL_SIZE - 220);
+        assert_non_null(c);
+        assert_int_equal(c->size, POOL_SIZE - 220);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, 3, 0);
+        char *mem = b->mem;
+        assert_int_equal(mem_del_alloc(pool, b), ALLOC_OK);
+        b = mem_new_alloc(pool, 90);
+        assert_ptr_equal(b->mem, mem);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE, 3, 0);
+        // and one at it is split off
+        assert_int_equal(mem_del_alloc(pool, b), ALLOC_OK);
+        b = mem_new_alloc(pool, 68);
+        check_metadata(pool, policy, POOL_SIZE, POOL_SIZE - 32, 3, 1);
+        assert_int_equal(mem_pool_frag(pool, &frag), ALLOC_OK);
+        assert_int_equal(frag.requested_size, POOL_SIZE - 52);
+        assert_int_equal(frag.alloc_size, POOL_SIZE - 32);
+        assert_int_equal(frag.num_small_gaps, 1);
+        assert_int_equal(mem_del_alloc(pool, a), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, b), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, c), ALLOC_OK);
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+        // size classes: linear up to 8 granules, then four per power of 2
+        opts = (pool_opts_t) { POOL_SIZE_CLASSES, 0, 16, 0 };
+        pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+        assert_non_null(pool);
+        const size_t sizes[][2] = {
+                { 1, 16 }, { 128, 128 }, { 129, 160 }, { 300, 320 }, { 1000, 1024 }, { 4097, 5120 },
+        };
+        const unsigned num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+        for (unsigned i = 0; i < num_sizes; ++i) {
+            size_t before = pool->alloc_size;
+            allocs[i] = mem_new_alloc(pool, sizes[i][0]);
+            assert_non_null(allocs[i]);
+            assert_int_equal(allocs[i]->size, sizes[i][0]);
+            assert_int_equal(pool->alloc_size - before, sizes[i][1]);
+        }
+        for (unsigned i = 0; i < num_sizes; ++i) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+        check_metadata(pool, policy, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // gaps between blocks are external fragmentation, tags internal
+    pool_opts_t tags = { POOL_BOUNDARY_TAGS };
+    pool_pt pool = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &tags);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < num_allocs; ++i) {
+        allocs[i] = mem_new_alloc(pool, 10);
+        assert_non_null(allocs[i]);
+    }
+    for (unsigned i = 0; i < num_allocs; i += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_frag(pool, &frag), ALLOC_OK);
+    assert_int_equal(frag.requested_size, 10 * num_allocs / 2);
+    assert_int_equal(frag.alloc_size, MEM_TAG_BLOCK_SIZE(10) * num_allocs / 2);
+    assert_int_equal(frag.num_gaps, num_allocs / 2 + 1);
+    assert_int_equal(frag.num_small_gaps, num_allocs / 2);
+    assert_true(frag.internal > 0.0 && frag.external > 0.0);
+    for (unsigned i = 1; i < num_allocs; i += 2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_free_ptr(void **state) {
+    INFO("A block is freed by its address alone, in whatever pool it is");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_opts_t tagOpts = { POOL_BOUNDARY_TAGS };
+    pool_opts_t deferredOpts = { POOL_DEFERRED_COALESCING };
+    pool_pt pools[5] = {
+            mem_pool_open(POOL_SIZE, FIRST_FIT),
+            mem_pool_open(POOL_SIZE, BEST_FIT),
+            mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &tagOpts),
+            mem_pool_open_opts(POOL_SIZE, BEST_FIT, &deferredOpts),
+            mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 4)
+    };
+    mem_context_pt ctx = mem_context_create();
+    assert_non_null(ctx);
+    pool_pt other = mem_pool_open_in(ctx, POOL_SIZE, BEST_FIT, NULL);
+    assert_non_null(other);
+
+    // a few hundred blocks in each, freed in another order
+    char *ptrs[6][300];
+    for (unsigned p = 0; p < 6; ++p) {
+        pool_pt pool = (p < 5) ? pools[p] : other;
+        assert_non_null(pool);
+        for (unsigned i = 0; i < 300; ++i) {
+            alloc_pt alloc = mem_new_alloc(pool, 10 + i % 7);
+            assert_non_null(alloc);
+            ptrs[p][i] = alloc->mem;
+        }
+    }
+    for (unsigned i = 0; i < 300; i += 2) {
+        for (unsigned p = 0; p < 6; ++p) {
+            assert_int_equal(mem_free_ptr(ptrs[p][i]), ALLOC_OK);
+        }
+    }
+    // not the start of a block, or not in a pool at all
+    char local;
+    assert_int_equal(mem_free_ptr(&local), ALLOC_FAIL);
+    assert_int_equal(mem_free_ptr(ptrs[0][1] + 1), ALLOC_FAIL);
+    assert_int_equal(mem_free_ptr(ptrs[1][0]), ALLOC_FAIL);
+    // in a boundary-tag block, a word that looks like an allocated tag
+    // doesn't start a block
+    char *tagged = mem_alloc(pools[2], 200);
+    assert_non_null(tagged);
+    *(size_t *) (tagged + 8) = 65;
+    *(size_t *) (tagged + 16) = 7;
+    assert_int_equal(mem_ptr_size(tagged + 32), 0);
+    assert_null(mem_pool_alloc_at(pools[2], (size_t) (tagged + 32 - pools[2]->mem)));
+    assert_int_equal(mem_free_ptr(tagged + 32), ALLOC_FAIL);
+    assert_int_equal(mem_free_ptr(tagged), ALLOC_OK);
+    // blocks handed out again are found at their new address (the
+    // deferred pool reuses the last block of the size freed)
+    for (unsigned p = 0; p < 4; ++p) {
+        alloc_pt alloc = mem_new_alloc(pools[p], 10);
+        assert_non_null(alloc);
+        if (p < 3) {
+            assert_ptr_equal(alloc->mem, ptrs[p][0]);
+        }
+        ptrs[p][0] = alloc->mem;
+    }
+    for (unsigned i = 1; i < 300; i += 2) {
+        for (unsigned p = 0; p < 6; ++p) {
+            assert_int_equal(mem_free_ptr(ptrs[p][i]), ALLOC_OK);
+        }
+    }
+    for (unsigned p = 0; p < 4; ++p) {
+        assert_int_equal(mem_free_ptr(ptrs[p][0]), ALLOC_OK);
+        check_metadata(pools[p], pools[p]->policy, POOL_SIZE, 0, 0, p == 3 ? pools[p]->num_gaps : 1);
+    }
+
+    for (unsigned p = 0; p < 5; ++p) {
+        assert_int_equal(mem_pool_close(pools[p]), ALLOC_OK);
+    }
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    // a closed pool is out of the index
+    assert_int_equal(mem_free_ptr(ptrs[0][0]), ALLOC_FAIL);
+    assert_int_equal(mem_context_destroy(ctx), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_concurrent_inspect(void **state) {
+    INFO("Stats and inspection are consistent while another thread allocates");
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    alloc_pt allocs[500];
+
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; ++policy) {
+        pool_pt pool = mem_pool_open(POOL_SIZE, policy);
+        assert_non_null(pool);
+
+        monitor_args_t args = { pool, 0, 0 };
+        pthread_t thread;
+        void *result = NULL;
+        assert_int_equal(pthread_create(&thread, NULL, monitor_thread, &args), 0);
+
+        // grow the node heap and punch holes, over and over
+        for (unsigned round = 0; round < 20; ++round) {
+            for (unsigned i = 0; i < 500; ++i) {
+                allocs[i] = mem_new_alloc(pool, 100);
+                assert_non_null(allocs[i]);
+            }
+            for (unsigned i = 0; i < 500; i += 2) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            }
+            for (unsigned i = 1; i < 500; i += 2) {
+                assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            }
+        }
+
+        atomic_store(&args.stop, 1);
+        assert_int_equal(pthread_join(thread, &result), 0);
+        assert_ptr_equal(result, &args);
+
+        pool_t stats;
+        assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+        assert_int_equal(stats.alloc_size, 0);
+        assert_int_equal(stats.num_allocs, 0);
+        assert_int_equal(stats.num_gaps, 1);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    // a pool whose tags were overwritten doesn't add up, and isn't
+    // walked over and over: it has no segments
+    pool_opts_t tagOpts = { POOL_BOUNDARY_TAGS };
+    pool_pt tags = mem_pool_open_opts(POOL_SIZE, FIRST_FIT, &tagOpts);
+    assert_non_null(tags);
+    char *first = mem_alloc(tags, 100);
+    char *second = mem_alloc(tags, 100);
+    assert_non_null(first);
+    assert_non_null(second);
+    size_t *tag = (size_t *) (first - 24);
+    size_t saved = *tag;
+    *tag = saved + MEM_TAG_BLOCK_SIZE(100);
+    pool_segment_pt segs = (pool_segment_pt) tags;
+    unsigned size = 1;
+    mem_inspect_pool(tags, &segs, &size);
+    assert_null(segs);
+    assert_int_equal(size, 0);
+    *tag = saved;
+    check_metadata(tags, FIRST_FIT, POOL_SIZE, 200, 2, 1);
+    assert_int_equal(mem_release(tags, first), ALLOC_OK);
+    assert_int_equal(mem_release(tags, second), ALLOC_OK);
+    assert_int_equal(mem_pool_close(tags), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+/*******************************************/
+/***          6. STRESS TEST             ***/
 /***                                     ***/
-/***         [non-functional]            ***/
 /***         [see NOTE below]            ***/
 /*******************************************/
 
@@ -2338,14 +4087,13 @@ void test_pool_stresstest(void **state) {
     alloc_pt allocations[num_pools][num_allocations];
 
     /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
+     * NOTE: This used to require the address of the allocation
+     * in the pool to be returned to the user instead of the
+     * address of the allocation record, because allocation records
+     * were a part of the nodes and shifted with them whenever the
+     * node heap was reallocated. Allocation records now live in
+     * chunks of their own which are never moved, so the records
+     * handed out to the user survive the node heap growing.
      */
 
     /*
@@ -2408,13 +4156,15 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_pool_store_smoketest),
             cmocka_unit_test(test_pool_smoketest),
+            cmocka_unit_test(test_pool_store_handles),
+            cmocka_unit_test(test_pool_contexts),
 
             cmocka_unit_test(test_pool_nonempty),
 
@@ -2443,14 +4193,32 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test(test_pool_boundary_tags),
+            cmocka_unit_test(test_pool_placement_model),
+            cmocka_unit_test(test_pool_tag_gap_order),
+            cmocka_unit_test(test_pool_deferred_coalescing),
+            cmocka_unit_test(test_pool_deferred_full_bins),
+            cmocka_unit_test(test_pool_background_maintenance),
+            cmocka_unit_test(test_pool_decay_purge),
+            cmocka_unit_test(test_pool_reserve),
+            cmocka_unit_test(test_pool_numa_placement),
+            cmocka_unit_test(test_pool_file),
+            cmocka_unit_test(test_pool_shared),
+            cmocka_unit_test(test_pool_owner_thread),
+            cmocka_unit_test(test_pool_locked),
+            cmocka_unit_test(test_pool_sharded),
+            cmocka_unit_test(test_pool_raw_alloc),
+            cmocka_unit_test(test_pool_release_sized),
+            cmocka_unit_test(test_pool_granularity),
+            cmocka_unit_test(test_pool_free_ptr),
+            cmocka_unit_test(test_pool_concurrent_inspect),
+
+            cmocka_unit_test(test_pool_stresstest),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */
-// TODO stress test: many pools, many allocations, many gaps (requires project refactoring, see NOTE in test body)
 // TODO test memory leaks: any way to do it w/o having to rewrite the source file?
 // TODO fix the final PASSED line of std::cerr output to the end of the file (?)
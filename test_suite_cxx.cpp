@@ -0,0 +1,271 @@
+//
+// Tests of the C++ adapters over the pools (mem_pool.hpp).
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <list>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+extern "C" {
+#include "cmocka.h"
+}
+#include "mem_pool.hpp"
+
+
+/*****             macros              *****/
+
+#define INFO(...)                                     \
+                            printf("[      --> ] ");  \
+                            printf(__VA_ARGS__);
+
+
+/*****            constants            *****/
+
+static const unsigned POOL_SIZE = 1000000;
+static const unsigned NUM_ELEMENTS = 1000;
+
+
+/*****         helper routines         *****/
+
+static bool in_pool(pool_pt pool, const void *ptr) {
+    const char *mem = static_cast<const char *>(ptr);
+    return mem >= pool->mem && mem < pool->mem + pool->total_size;
+}
+
+// counts the live objects
+struct message {
+    static int live;
+    unsigned id;
+    char payload[20];
+
+    explicit message(unsigned id) : id(id) { ++live; }
+    ~message() { --live; }
+};
+
+int message::live = 0;
+
+struct alignas(64) cache_line {
+    unsigned id;
+};
+
+
+/*****          test routines          *****/
+
+static void test_pool_resource(void **state) {
+    INFO("pmr containers allocate from a pool through mem_pool_resource\n");
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    const unsigned flags[] = { POOL_DEFAULT, POOL_DEFERRED_COALESCING, POOL_BOUNDARY_TAGS };
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; policy = (alloc_policy) (policy + 1)) {
+        for (unsigned flag : flags) {
+            pool_opts_t opts = { flag, 0 };
+            pool_pt pool = mem_pool_open_opts(POOL_SIZE, policy, &opts);
+            assert_non_null(pool);
+            mem_pool_resource resource(pool);
+
+            {
+                std::pmr::vector<int> ints(&resource);
+                std::pmr::unordered_map<int, std::pmr::string> names(&resource);
+                for (unsigned i = 0; i < NUM_ELEMENTS; ++i) {
+                    ints.push_back((int) i);
+                    // too long for the small string buffer
+                    names.emplace((int) i, std::pmr::string(40, (char) ('a' + i % 26)));
+                }
+                assert_true(in_pool(pool, ints.data()));
+                assert_true(in_pool(pool, names.at(7).data()));
+                for (unsigned i = 0; i < NUM_ELEMENTS; ++i) {
+                    assert_int_equal(ints[i], i);
+                    assert_int_equal(names.at((int) i)[39], 'a' + i % 26);
+                }
+                assert_int_not_equal(pool->num_allocs, 0);
+            }
+            assert_int_equal(pool->num_allocs, 0);
+
+            // over-aligned blocks are padded
+            for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+                void *ptr = resource.allocate(24, alignment);
+                assert_true(in_pool(pool, ptr));
+                assert_int_equal(reinterpret_cast<std::uintptr_t>(ptr) % alignment, 0);
+                resource.deallocate(ptr, 24, alignment);
+            }
+            assert_int_equal(pool->num_allocs, 0);
+
+            // blocks are freed with their size, checked against it
+            void *block = resource.allocate(24);
+            resource.deallocate(block, 24);
+            assert_int_equal(pool->num_allocs, 0);
+#ifdef NDEBUG
+            // a wrong size, asserted in debug builds, doesn't leak the block
+            block = resource.allocate(24);
+            resource.deallocate(block, 100);
+            assert_int_equal(pool->num_allocs, 0);
+            block = resource.allocate(24);
+            resource.deallocate(block, SIZE_MAX);
+            assert_int_equal(pool->num_allocs, 0);
+#endif
+
+            // resources over one pool are interchangeable
+            mem_pool_resource same(pool);
+            assert_true(resource.is_equal(same));
+            assert_false(resource.is_equal(*std::pmr::new_delete_resource()));
+
+            bool thrown = false;
+            try {
+                (void) resource.allocate(POOL_SIZE);
+            } catch (const std::bad_alloc &) {
+                thrown = true;
+            }
+            assert_true(thrown);
+
+            assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        }
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_allocator(void **state) {
+    INFO("Standard containers allocate from a pool through PoolAllocator\n");
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    pool_pt other = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    assert_non_null(other);
+
+    {
+        PoolAllocator<int> alloc(pool);
+        std::vector<int, PoolAllocator<int>> ints(alloc);
+        // node containers rebind the allocator to their nodes
+        std::map<int, long double, std::less<int>,
+                 PoolAllocator<std::pair<const int, long double>>> values(alloc);
+        std::list<std::string, PoolAllocator<std::string>> strings(alloc);
+        for (unsigned i = 0; i < NUM_ELEMENTS; ++i) {
+            ints.push_back((int) i);
+            values[(int) i] = i / 2.0L;
+            strings.emplace_back(std::to_string(i));
+        }
+        assert_true(in_pool(pool, ints.data()));
+        assert_true(in_pool(pool, &values.at(3)));
+        assert_true(in_pool(pool, &strings.front()));
+        assert_int_equal(reinterpret_cast<std::uintptr_t>(&values.at(5)) % alignof(long double), 0);
+        assert_true(values.at(5) == 2.5L);
+        assert_true(strings.back() == std::to_string(NUM_ELEMENTS - 1));
+
+        // allocators over the same pool compare equal, rebound or not
+        assert_true(alloc == PoolAllocator<char>(pool));
+        assert_true(alloc != PoolAllocator<int>(other));
+
+        // the pool goes with the contents
+        std::vector<int, PoolAllocator<int>> others{PoolAllocator<int>(other)};
+        others.push_back(-1);
+        others.swap(ints);
+        assert_int_equal(ints.get_allocator().pool(), other);
+        assert_int_equal(others.get_allocator().pool(), pool);
+        assert_int_equal(others[NUM_ELEMENTS - 1], NUM_ELEMENTS - 1);
+        assert_int_equal(ints[0], -1);
+
+        bool thrown = false;
+        try {
+            (void) alloc.allocate(SIZE_MAX / 2);
+        } catch (const std::bad_array_new_length &) {
+            thrown = true;
+        }
+        assert_true(thrown);
+    }
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(other->num_allocs, 0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_object_pool(void **state) {
+    INFO("Objects of a type are allocated from slabs of slots in a pool\n");
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    const unsigned num_objects = 100;
+    for (alloc_policy policy = FIRST_FIT; policy <= BEST_FIT; policy = (alloc_policy) (policy + 1)) {
+        pool_pt pool = mem_pool_open(POOL_SIZE, policy);
+        assert_non_null(pool);
+
+        {
+            ObjectPool<message, 16> messages(pool);
+            message *objects[100];
+            for (unsigned i = 0; i < num_objects; ++i) {
+                objects[i] = messages.create(i);
+                assert_true(in_pool(pool, objects[i]));
+                assert_int_equal(reinterpret_cast<std::uintptr_t>(objects[i]) % alignof(message), 0);
+            }
+            assert_int_equal(message::live, num_objects);
+            // a slab is a single allocation of the pool
+            assert_int_equal(messages.num_slabs(), (num_objects + 15) / 16);
+            assert_int_equal(pool->num_allocs, messages.num_slabs());
+            for (unsigned i = 0; i < num_objects; ++i) {
+                assert_int_equal(objects[i]->id, i);
+                for (unsigned j = 0; j < i; ++j) {
+                    assert_int_not_equal(objects[i], objects[j]);
+                }
+            }
+
+            // the last slot freed is the next one allocated
+            messages.destroy(objects[42]);
+            assert_int_equal(message::live, num_objects - 1);
+            assert_int_equal(messages.create(142), objects[42]);
+            for (unsigned i = 0; i < num_objects; ++i) {
+                messages.destroy(objects[i]);
+            }
+            assert_int_equal(message::live, 0);
+            assert_int_equal(pool->num_allocs, messages.num_slabs());
+
+            // pointers destroy their objects into the object pool
+            {
+                pooled_ptr<message, 16> ptr = make_pooled<message>(messages, 7u);
+                assert_int_equal(ptr->id, 7);
+                assert_int_equal(message::live, 1);
+            }
+            assert_int_equal(message::live, 0);
+
+            // over-aligned objects get aligned slots
+            ObjectPool<cache_line, 3> lines(pool);
+            for (unsigned i = 0; i < 10; ++i) {
+                cache_line *line = lines.create();
+                assert_int_equal(reinterpret_cast<std::uintptr_t>(line) % 64, 0);
+                assert_true(in_pool(pool, line));
+            }
+        }
+        // the slabs go back to the pool
+        assert_int_equal(pool->num_allocs, 0);
+
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*****          main                   *****/
+
+int main(int argc, char *argv[]) {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(test_pool_resource),
+            cmocka_unit_test(test_pool_allocator),
+            cmocka_unit_test(test_object_pool),
+    };
+
+    return cmocka_run_group_tests_name("pool_cxx_test_suite", tests, NULL, NULL);
+}